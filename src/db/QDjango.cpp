@@ -15,27 +15,153 @@
  * Lesser General Public License for more details.
  */
 
+#include <QAtomicInt>
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QRegExp>
 #include <QSqlDriver>
 #include <QSqlError>
+#include <QSqlField>
 #include <QSqlQuery>
 #include <QStringList>
 #include <QThread>
 #include <QStack>
 
 #include "QDjango.h"
+#include "QDjangoQueryObserver.h"
+#include "QDjangoQuerySet_p.h"
 
 static const char *connectionPrefix = "_qdjango_";
 
 QMap<QByteArray, QDjangoMetaModel> globalMetaModels = QMap<QByteArray, QDjangoMetaModel>();
+
+// dense registry, the id of a model is its index in globalModelList
+static QList<QDjangoMetaModel> globalModelList;
+static QHash<QByteArray, int> globalModelIds;
+static QHash<const QMetaObject*, int> globalMetaObjectIds;
 static QDjangoDatabase *globalDatabase = 0;
 static QDjangoDatabase::DatabaseType globalDatabaseType = QDjangoDatabase::UnknownDB;
+static bool globalDatabaseJson = false;
+static bool globalDatabaseWindow = false;
 static bool globalDebugEnabled = false;
 
+// the count is read atomically without locking so that queries only pay for
+// tracing once an observer has been installed
+static QList<QDjangoQueryObserver*> globalObservers;
+static QReadWriteLock globalObserverLock;
+static QAtomicInt globalObserverCount(0);
+
+static inline bool hasQueryObservers()
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+    return globalObserverCount.loadAcquire() != 0;
+#else
+    return globalObserverCount != 0;
+#endif
+}
+
+// results of recent COUNT queries, with the time at which they expire
+static QHash<QString, QPair<int, qint64> > globalCountCache;
+static QMutex globalCountCacheMutex;
+static QAtomicInt globalCountCacheTimeout(0);
+
+static inline int loadCountCacheTimeout()
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+    return globalCountCacheTimeout.loadAcquire();
+#else
+    return globalCountCacheTimeout;
+#endif
+}
+
+/*!
+    Constructs an empty QDjangoQueryEvent.
+*/
+QDjangoQueryEvent::QDjangoQueryEvent()
+    : rowsReturned(-1)
+    , rowsAffected(-1)
+    , prepareTime(0)
+    , executionTime(0)
+    , fetchTime(0)
+    , success(false)
+{
+}
+
+/*!
+    Returns the fingerprint of the given \a sql statement.
+
+    Quoted strings and numbers are replaced by placeholders, and lists of
+    placeholders such as those of an IN clause or a multi-row INSERT are
+    collapsed to a single one.
+*/
+QString QDjangoQueryEvent::fingerprint(const QString &sql)
+{
+    const QRegExp stringRx(QLatin1String("'(?:[^']|'')*'"));
+    // a minus sign is part of the number unless it follows an operand
+    const QRegExp numberRx(QLatin1String("(^|[^\\w)])-?\\d+(?:\\.\\d+)?\\b"));
+    const QRegExp listRx(QLatin1String("\\?(?:\\s*,\\s*\\?)+"));
+    const QRegExp rowsRx(QLatin1String("\\(\\?\\)(?:\\s*,\\s*\\(\\?\\))+"));
+
+    QString result = sql;
+    result.replace(stringRx, QLatin1String("?"));
+    result.replace(numberRx, QLatin1String("\\1?"));
+    result.replace(listRx, QLatin1String("?"));
+    result.replace(rowsRx, QLatin1String("(?)"));
+    return result;
+}
+
+/*!
+    Destroys the QDjangoQueryObserver.
+*/
+QDjangoQueryObserver::~QDjangoQueryObserver()
+{
+}
+
 /// \cond
 
+class QDjangoQueryTrace
+{
+public:
+    QDjangoQueryTrace()
+        : pending(false)
+    {
+    }
+
+    ~QDjangoQueryTrace()
+    {
+        report();
+    }
+
+    void report();
+
+    QDjangoQueryEvent event;
+    bool pending;
+};
+
+void QDjangoQueryTrace::report()
+{
+    if (!pending)
+        return;
+    pending = false;
+
+    event.fingerprint = QDjangoQueryEvent::fingerprint(event.sql);
+
+    // dispatch outside the lock, so that observers may run queries or
+    // add and remove observers themselves
+    QList<QDjangoQueryObserver*> observers;
+    {
+        QReadLocker locker(&globalObserverLock);
+        observers = globalObservers;
+    }
+    foreach (QDjangoQueryObserver *observer, observers)
+        observer->queryExecuted(event);
+    event = QDjangoQueryEvent();
+}
+
 QDjangoDatabase::QDjangoDatabase(QObject *parent)
     : QObject(parent), connectionId(0)
 {
@@ -91,6 +217,28 @@ static QDjangoDatabase::DatabaseType getDatabaseType(QSqlDatabase &db)
     return QDjangoDatabase::UnknownDB;
 }
 
+static bool getJsonSupport(QSqlDatabase &db, QDjangoDatabase::DatabaseType databaseType)
+{
+    // the JSON functions are optional in SQLite before version 3.38
+    if (databaseType == QDjangoDatabase::SQLite) {
+        QSqlQuery query(db);
+        return query.exec(QLatin1String("SELECT json_valid('[]')"));
+    }
+    return false;
+}
+
+static bool getWindowSupport(QSqlDatabase &db, QDjangoDatabase::DatabaseType databaseType)
+{
+    // window functions require SQLite 3.25 or MySQL 8.0
+    if (databaseType == QDjangoDatabase::PostgreSQL)
+        return true;
+    if (databaseType == QDjangoDatabase::SQLite || databaseType == QDjangoDatabase::MySqlServer) {
+        QSqlQuery query(db);
+        return query.exec(QLatin1String("SELECT COUNT(*) OVER ()"));
+    }
+    return false;
+}
+
 static void initDatabase(QSqlDatabase db)
 {
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
@@ -104,6 +252,7 @@ static void initDatabase(QSqlDatabase db)
 
 QDjangoQuery::QDjangoQuery(QSqlDatabase db)
     : QSqlQuery(db)
+    , m_connectionName(db.connectionName())
 {
     if (QDjangoDatabase::databaseType(db) == QDjangoDatabase::MSSqlServer) {
         // default to fast-forward cursor
@@ -121,6 +270,33 @@ void QDjangoQuery::addBindValue(const QVariant &val, QSql::ParamType paramType)
         QSqlQuery::addBindValue(val, paramType);
 }
 
+void QDjangoQuery::addBindValues(const QVariantList &values, QSql::ParamType paramType)
+{
+    // the values of a column share the same type, so look it up once
+    // and only convert the vector if it holds date times
+    QVariant::Type type = QVariant::Invalid;
+    foreach (const QVariant &val, values) {
+        if (!val.isNull()) {
+            type = val.type();
+            break;
+        }
+    }
+
+    if (type == QVariant::DateTime) {
+        QVariantList localValues;
+        localValues.reserve(values.size());
+        foreach (const QVariant &val, values) {
+            if (val.type() == QVariant::DateTime)
+                localValues << val.toDateTime().toLocalTime();
+            else
+                localValues << val;
+        }
+        QSqlQuery::addBindValue(localValues, paramType);
+    } else {
+        QSqlQuery::addBindValue(values, paramType);
+    }
+}
+
 bool QDjangoQuery::exec()
 {
     if (globalDebugEnabled) {
@@ -132,7 +308,15 @@ bool QDjangoQuery::exec()
                      << i.value().toString().toLatin1().data();
         }
     }
-    if (!QSqlQuery::exec()) {
+    QElapsedTimer timer;
+    if (hasQueryObservers())
+        timer.start();
+    const bool ok = QSqlQuery::exec();
+    if (hasQueryObservers())
+        trace(lastQuery(), ok, timer.nsecsElapsed());
+    if (loadCountCacheTimeout() && !isSelect())
+        QDjangoCountCache::invalidate(lastQuery());
+    if (!ok) {
         if (globalDebugEnabled)
             qWarning() << "SQL error" << lastError();
         return false;
@@ -144,7 +328,42 @@ bool QDjangoQuery::exec(const QString &query)
 {
     if (globalDebugEnabled)
         qDebug() << "SQL query" << query;
-    if (!QSqlQuery::exec(query)) {
+    QElapsedTimer timer;
+    if (hasQueryObservers())
+        timer.start();
+    const bool ok = QSqlQuery::exec(query);
+    if (hasQueryObservers())
+        trace(query, ok, timer.nsecsElapsed());
+    if (loadCountCacheTimeout() && !isSelect())
+        QDjangoCountCache::invalidate(query);
+    if (!ok) {
+        if (globalDebugEnabled)
+            qWarning() << "SQL error" << lastError();
+        return false;
+    }
+    return true;
+}
+
+bool QDjangoQuery::execBatch(BatchExecutionMode mode)
+{
+    if (globalDebugEnabled) {
+        qDebug() << "SQL batch" << lastQuery();
+        QMapIterator<QString, QVariant> i(boundValues());
+        while (i.hasNext()) {
+            i.next();
+            qDebug() << "SQL   " << i.key().toLatin1().data() << "="
+                     << i.value().toList().size() << "values";
+        }
+    }
+    QElapsedTimer timer;
+    if (hasQueryObservers())
+        timer.start();
+    const bool ok = QSqlQuery::execBatch(mode);
+    if (hasQueryObservers())
+        trace(lastQuery(), ok, timer.nsecsElapsed());
+    if (loadCountCacheTimeout() && !isSelect())
+        QDjangoCountCache::invalidate(lastQuery());
+    if (!ok) {
         if (globalDebugEnabled)
             qWarning() << "SQL error" << lastError();
         return false;
@@ -152,6 +371,68 @@ bool QDjangoQuery::exec(const QString &query)
     return true;
 }
 
+bool QDjangoQuery::next()
+{
+    if (!m_trace || !m_trace->pending)
+        return QSqlQuery::next();
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::next();
+    m_trace->event.fetchTime += timer.nsecsElapsed();
+    if (ok)
+        m_trace->event.rowsReturned++;
+    else
+        m_trace->report();
+    return ok;
+}
+
+bool QDjangoQuery::prepare(const QString &query)
+{
+    if (m_trace)
+        m_trace->report();
+    if (!hasQueryObservers())
+        return QSqlQuery::prepare(query);
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::prepare(query);
+    if (!m_trace)
+        m_trace = QSharedPointer<QDjangoQueryTrace>(new QDjangoQueryTrace);
+    m_trace->event.prepareTime = timer.nsecsElapsed();
+    return ok;
+}
+
+void QDjangoQuery::trace(const QString &sql, bool ok, qint64 elapsed)
+{
+    if (!m_trace)
+        m_trace = QSharedPointer<QDjangoQueryTrace>(new QDjangoQueryTrace);
+    else
+        m_trace->report();
+
+    QDjangoQueryEvent &event = m_trace->event;
+    event.sql = sql;
+    event.connectionName = m_connectionName;
+    event.boundValues.clear();
+    const int bindCount = boundValues().size();
+    for (int i = 0; i < bindCount; ++i)
+        event.boundValues << boundValue(i);
+    event.executionTime = elapsed;
+    event.success = ok;
+    if (ok) {
+        event.rowsAffected = numRowsAffected();
+    } else {
+        event.error = lastError().text();
+    }
+    m_trace->pending = true;
+
+    // the rows of a SELECT are counted as they are fetched
+    if (ok && isSelect())
+        event.rowsReturned = 0;
+    else
+        m_trace->report();
+}
+
 /// \endcond
 
 /*!
@@ -201,6 +482,8 @@ void QDjango::setDatabase(QSqlDatabase database)
     if (globalDatabaseType == QDjangoDatabase::UnknownDB) {
         qWarning() << "Unsupported database driver" << database.driverName();
     }
+    globalDatabaseJson = getJsonSupport(database, globalDatabaseType);
+    globalDatabaseWindow = getWindowSupport(database, globalDatabaseType);
 
     if (!globalDatabase)
     {
@@ -231,6 +514,75 @@ void QDjango::setDebugEnabled(bool enabled)
     globalDebugEnabled = enabled;
 }
 
+/*!
+    Returns the number of milliseconds for which the result of a COUNT
+    query is cached, or 0 if counts are not cached.
+
+    \sa setCountCacheTimeout()
+*/
+int QDjango::countCacheTimeout()
+{
+    return loadCountCacheTimeout();
+}
+
+/*!
+    Sets the number of milliseconds for which the result of a COUNT query
+    is cached, keyed by its SQL and bound values. A value of 0, which is
+    the default, disables the cache.
+
+    This saves a round trip for paginated views which count the same
+    queryset on every request. When QDjango executes a statement which
+    writes to a table, the counts reading that table are dropped, but
+    changes made by other connections are only seen once the entries
+    expire, so the timeout should be kept short.
+
+    Transactions are not tracked either: a count cached inside a
+    transaction which is then rolled back is kept until it expires. Calling
+    setCountCacheTimeout() clears the cache, so you can call it again
+    after a rollback.
+
+    \sa countCacheTimeout()
+*/
+void QDjango::setCountCacheTimeout(int msecs)
+{
+    globalCountCacheTimeout.fetchAndStoreOrdered(qMax(msecs, 0));
+    QDjangoCountCache::clear();
+}
+
+/*!
+    Installs an \a observer which is notified of every SQL statement
+    executed by QDjango, along with its timings.
+
+    The observer is not owned by QDjango, you must remove it before
+    deleting it.
+
+    \sa removeQueryObserver()
+*/
+void QDjango::addQueryObserver(QDjangoQueryObserver *observer)
+{
+    QWriteLocker locker(&globalObserverLock);
+    if (observer && !globalObservers.contains(observer)) {
+        globalObservers << observer;
+        globalObserverCount.fetchAndStoreOrdered(globalObservers.size());
+    }
+}
+
+/*!
+    Removes a previously installed query \a observer.
+
+    Statements which other threads are reporting at the same time may
+    still reach the observer after this returns, so observers shared
+    between threads must outlive them.
+
+    \sa addQueryObserver()
+*/
+void QDjango::removeQueryObserver(QDjangoQueryObserver *observer)
+{
+    QWriteLocker locker(&globalObserverLock);
+    globalObservers.removeAll(observer);
+    globalObserverCount.fetchAndStoreOrdered(globalObservers.size());
+}
+
 /*!
     returns an already registered model
 
@@ -238,7 +590,7 @@ void QDjango::setDebugEnabled(bool enabled)
 */
 QDjangoMetaModel QDjango::metaModel(const QObject *model)
 {
-    return metaModel(model->metaObject()->className());
+    return metaModel(model->metaObject());
 }
 
 static void qdjango_topsort(const QByteArray &modelName, QHash<QByteArray, bool> &visited,
@@ -311,8 +663,9 @@ bool QDjango::dropTables()
  */
 QDjangoMetaModel QDjango::metaModel(const char *name)
 {
-    if (globalMetaModels.contains(name))
-        return globalMetaModels.value(name);
+    QHash<QByteArray, int>::const_iterator it = globalModelIds.constFind(QByteArray::fromRawData(name, qstrlen(name)));
+    if (it != globalModelIds.constEnd())
+        return globalModelList.at(it.value());
 
     // otherwise, try to find a model anyway
     foreach (QByteArray modelName, globalMetaModels.keys()) {
@@ -323,12 +676,71 @@ QDjangoMetaModel QDjango::metaModel(const char *name)
     return QDjangoMetaModel();
 }
 
-QDjangoMetaModel QDjango::registerModel(const QMetaObject *meta)
+/*!
+    Returns the QDjangoMetaModel for the given \a meta object.
+ */
+QDjangoMetaModel QDjango::metaModel(const QMetaObject *meta)
+{
+    QHash<const QMetaObject*, int>::const_iterator it = globalMetaObjectIds.constFind(meta);
+    if (it != globalMetaObjectIds.constEnd())
+        return globalModelList.at(it.value());
+    return metaModel(meta->className());
+}
+
+/*!
+    Returns the QDjangoMetaModel with the given registry \a id.
+ */
+QDjangoMetaModel QDjango::metaModel(int id)
+{
+    if (id < 0 || id >= globalModelList.size())
+        return QDjangoMetaModel();
+    return globalModelList.at(id);
+}
+
+/*!
+    Returns the QDjangoMetaModel of every registered model.
+ */
+QList<QDjangoMetaModel> QDjango::metaModels()
+{
+    return globalModelList;
+}
+
+/*!
+    Returns the registry id of the model with the given class \a name,
+    or -1 if the model is not registered.
+ */
+int QDjango::modelId(const char *name)
+{
+    return globalModelIds.value(QByteArray::fromRawData(name, qstrlen(name)), -1);
+}
+
+/*!
+    Returns the registry id of the model with the given \a meta object,
+    or -1 if the model is not registered.
+ */
+int QDjango::modelId(const QMetaObject *meta)
+{
+    return globalMetaObjectIds.value(meta, -1);
+}
+
+QDjangoMetaModel QDjango::registerModel(const QMetaObject *meta, const QDjangoModelAccessor &accessor)
 {
-    const QByteArray name = meta->className();
-    if (!globalMetaModels.contains(name))
-        globalMetaModels.insert(name, QDjangoMetaModel(meta));
-    return globalMetaModels[name];
+    const QByteArray name = meta ? QByteArray(meta->className()) : accessor.className;
+    QHash<QByteArray, int>::const_iterator it = globalModelIds.constFind(name);
+    if (it != globalModelIds.constEnd())
+        return globalModelList.at(it.value());
+
+    const int id = globalModelList.size();
+    const QDjangoMetaModel model(meta, accessor);
+    globalModelList.append(model);
+    globalModelIds.insert(name, id);
+    if (meta)
+        globalMetaObjectIds.insert(meta, id);
+    globalMetaModels.insert(name, model);
+
+    // lookups may resolve differently now, e.g. reverse relations
+    QDjangoCompiler::clearColumnPaths();
+    return model;
 }
 
 QDjangoDatabase::DatabaseType QDjangoDatabase::databaseType(const QSqlDatabase &db)
@@ -336,3 +748,132 @@ QDjangoDatabase::DatabaseType QDjangoDatabase::databaseType(const QSqlDatabase &
     Q_UNUSED(db);
     return globalDatabaseType;
 }
+
+bool QDjangoDatabase::hasJsonSupport(const QSqlDatabase &db)
+{
+    Q_UNUSED(db);
+    return globalDatabaseJson;
+}
+
+/** Overrides whether the JSON functions were found, which lets the tests
+ *  exercise the fallbacks for SQLite builds without them.
+ */
+void QDjangoDatabase::setJsonSupport(bool supported)
+{
+    globalDatabaseJson = supported;
+}
+
+bool QDjangoDatabase::hasWindowSupport(const QSqlDatabase &db)
+{
+    Q_UNUSED(db);
+    return globalDatabaseWindow;
+}
+
+/** Returns the given \a sql with its positional placeholders replaced by
+ *  the formatted \a values, for statements which cannot be prepared such
+ *  as DECLARE or EXPLAIN on PostgreSQL.
+ *
+ *  Like QtSql, question marks inside quoted strings or identifiers are
+ *  not taken as placeholders.
+ */
+QString QDjangoDatabase::inlineValues(const QSqlDatabase &db, const QString &sql, const QVariantList &values)
+{
+    QString inlined;
+    inlined.reserve(sql.size());
+    QChar quote;
+    int valueIndex = 0;
+    for (int i = 0; i < sql.size(); ++i) {
+        const QChar c = sql.at(i);
+        if (!quote.isNull()) {
+            // a doubled quote inside a literal is an escaped quote and
+            // closes then reopens it, which needs no special handling
+            if (c == quote)
+                quote = QChar();
+            inlined += c;
+        } else if (c == QLatin1Char('\'') || c == QLatin1Char('"') || c == QLatin1Char('`')) {
+            quote = c;
+            inlined += c;
+        } else if (c == QLatin1Char('?') && valueIndex < values.size()) {
+            const QVariant value = values.at(valueIndex++);
+            QSqlField field(QLatin1String("value"), value.type());
+            field.setValue(value);
+            inlined += db.driver()->formatValue(field);
+        } else {
+            inlined += c;
+        }
+    }
+    return inlined;
+}
+
+bool QDjangoCountCache::isEnabled()
+{
+    return loadCountCacheTimeout() > 0;
+}
+
+void QDjangoCountCache::clear()
+{
+    QMutexLocker locker(&globalCountCacheMutex);
+    globalCountCache.clear();
+}
+
+/** Drops the counts which the statement \a sql may have changed.
+ *
+ *  Writes to a table drop the counts whose SQL mentions it, statements
+ *  which do not change any rows such as BEGIN, PRAGMA or DECLARE keep
+ *  the cache and any other statement clears it.
+ */
+void QDjangoCountCache::invalidate(const QString &sql)
+{
+    QRegExp writeRx(QLatin1String("^\\s*(?:INSERT\\s+(?:OR\\s+\\w+\\s+)?INTO|REPLACE\\s+INTO|UPDATE(?:\\s+OR\\s+\\w+)?|DELETE\\s+FROM|TRUNCATE(?:\\s+TABLE)?|(?:ALTER|CREATE|DROP)\\s+TABLE(?:\\s+IF(?:\\s+NOT)?\\s+EXISTS)?)\\s+([^\\s(]+)"), Qt::CaseInsensitive);
+    if (writeRx.indexIn(sql) == 0) {
+        const QString table = writeRx.cap(1);
+        QMutexLocker locker(&globalCountCacheMutex);
+        QHash<QString, QPair<int, qint64> >::iterator it = globalCountCache.begin();
+        while (it != globalCountCache.end()) {
+            if (it.key().contains(table))
+                it = globalCountCache.erase(it);
+            else
+                ++it;
+        }
+        return;
+    }
+
+    // ROLLBACK is not listed, as it may undo writes counted since
+    QRegExp keepRx(QLatin1String("^\\s*(?:BEGIN|START|COMMIT|END|SAVEPOINT|RELEASE|PRAGMA|DECLARE|CLOSE|FETCH|MOVE|SET|SHOW|EXPLAIN|ANALYZE|VACUUM|(?:CREATE|DROP)\\s+(?:UNIQUE\\s+)?INDEX)\\b"), Qt::CaseInsensitive);
+    if (keepRx.indexIn(sql) != 0)
+        clear();
+}
+
+bool QDjangoCountCache::find(const QString &key, int *count)
+{
+    QMutexLocker locker(&globalCountCacheMutex);
+    QHash<QString, QPair<int, qint64> >::iterator it = globalCountCache.find(key);
+    if (it == globalCountCache.end())
+        return false;
+    if (it.value().second <= QDateTime::currentMSecsSinceEpoch()) {
+        globalCountCache.erase(it);
+        return false;
+    }
+    *count = it.value().first;
+    return true;
+}
+
+void QDjangoCountCache::insert(const QString &key, int count)
+{
+    QMutexLocker locker(&globalCountCacheMutex);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // drop expired entries once the cache grows
+    if (globalCountCache.size() >= 1024) {
+        QHash<QString, QPair<int, qint64> >::iterator it = globalCountCache.begin();
+        while (it != globalCountCache.end()) {
+            if (it.value().second <= now)
+                it = globalCountCache.erase(it);
+            else
+                ++it;
+        }
+        if (globalCountCache.size() >= 1024)
+            globalCountCache.clear();
+    }
+    globalCountCache.insert(key, qMakePair(count, now + loadCountCacheTimeout()));
+}
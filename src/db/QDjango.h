@@ -19,7 +19,10 @@
 #define QDJANGO_H
 
 #include "QDjangoMetaModel.h"
+#include "QDjangoModelDescriptor.h"
 
+class QDjangoQueryObserver;
+class QMetaObject;
 class QObject;
 class QSqlDatabase;
 class QSqlQuery;
@@ -43,26 +46,99 @@ public:
     static bool isDebugEnabled();
     static void setDebugEnabled(bool enabled);
 
+    static int countCacheTimeout();
+    static void setCountCacheTimeout(int msecs);
+
+    static void addQueryObserver(QDjangoQueryObserver *observer);
+    static void removeQueryObserver(QDjangoQueryObserver *observer);
+
     template <class T>
     static QDjangoMetaModel registerModel();
+    template <class T>
+    static QDjangoMetaModel metaModel();
     static QDjangoMetaModel metaModel(const QObject*);
 
 private:
-    static QDjangoMetaModel registerModel(const QMetaObject *meta);
+    static QDjangoMetaModel registerModel(const QMetaObject *meta, const QDjangoModelAccessor &accessor = QDjangoModelAccessor());
     static QDjangoMetaModel metaModel(const char *name);
+    static QDjangoMetaModel metaModel(const QMetaObject *meta);
+    static QDjangoMetaModel metaModel(int id);
+    static QList<QDjangoMetaModel> metaModels();
+    template <class T>
+    static int modelId();
+    static int modelId(const char *name);
+    static int modelId(const QMetaObject *meta);
 
     friend class QDjangoCompiler;
+    friend class QDjangoCursor;
+    friend class QDjangoIndexAdvisor;
     friend class QDjangoModel;
     friend class QDjangoMetaModel;
     friend class QDjangoQuerySetPrivate;
+    template <class T> friend class QDjangoQuerySet;
 };
 
+/// \cond
+
+/** \internal
+ *
+ *  Holds the registry id of the model class T, or -1 if it is not known yet.
+ */
+template <class T>
+class QDjangoModelId
+{
+public:
+    static int id;
+};
+
+template <class T>
+int QDjangoModelId<T>::id = -1;
+
+/// \endcond
+
+/** \internal
+ *
+ *  Looks up the registry id of model class T by its meta object, or by its
+ *  class name for plain models.
+ */
+template <class T>
+int QDjango::modelId()
+{
+    if (QDjangoModelTraits<T>::IsObject)
+        return modelId(QDjangoModelTraits<T>::metaObject());
+    return modelId(QDjangoModelTraits<T>::className());
+}
+
 /** Register a QDjangoModel class with QDjango.
+ *
+ *  If QDjangoModelDescriptor is specialized for T, the fields are taken
+ *  from the descriptor instead of the properties of T.
+ *
+ *  T can also be a plain model which does not derive from QObject, see
+ *  QDjangoModelTraits.
  */
 template <class T>
 QDjangoMetaModel QDjango::registerModel()
 {
-    return registerModel(&T::staticMetaObject);
+    QDjangoModelAccessor accessor;
+    if (QDjangoModelDescriptor<T>::IsDefined)
+        accessor = QDjangoModelAccessors<T>::accessor();
+    const QDjangoMetaModel model = registerModel(QDjangoModelTraits<T>::metaObject(), accessor);
+    QDjangoModelId<T>::id = modelId<T>();
+    return model;
+}
+
+/** Returns the QDjangoMetaModel of the registered QDjangoModel class T.
+ *
+ *  Unlike looking the model up by name, this is a simple array access
+ *  once the class has been registered.
+ */
+template <class T>
+QDjangoMetaModel QDjango::metaModel()
+{
+    if (QDjangoModelId<T>::id < 0)
+        QDjangoModelId<T>::id = modelId<T>();
+    return metaModel(QDjangoModelId<T>::id);
 }
 
 #endif
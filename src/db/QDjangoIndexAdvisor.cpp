@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <QHash>
+#include <QMutex>
+#include <QRegExp>
+#include <QSet>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QSqlRecord>
+
+#include "QDjango.h"
+#include "QDjangoIndexAdvisor.h"
+
+/// \cond
+
+// an identifier, which may be quoted for any of the supported databases
+static const char identifierPattern[] = "(?:\"([^\"]+)\"|`([^`]+)`|\\[([^\\]]+)\\]|([A-Za-z_]\\w*))";
+
+static QString identifier(const QRegExp &rx, int first)
+{
+    for (int i = first; i < first + 4; ++i) {
+        if (!rx.cap(i).isEmpty())
+            return rx.cap(i);
+    }
+    return QString();
+}
+
+static bool lessThanTime(const QDjangoIndexAdvisor::Suggestion &a, const QDjangoIndexAdvisor::Suggestion &b)
+{
+    if (a.time != b.time)
+        return a.time > b.time;
+    return a.count > b.count;
+}
+
+class QDjangoIndexUsage
+{
+public:
+    QString table;
+    QStringList columns;
+};
+
+class QDjangoStatementStats
+{
+public:
+    QDjangoStatementStats()
+        : count(0)
+        , time(0)
+    {
+    }
+
+    QString sql;
+    int count;
+    qint64 time;
+};
+
+class QDjangoIndexAdvisorPrivate
+{
+public:
+    QList<QStringList> databaseIndexes(const QSqlDatabase &db, const QString &table) const;
+    static QList<QDjangoIndexUsage> parse(const QString &sql);
+
+    QHash<QString, QDjangoStatementStats> statements;
+    mutable QMutex mutex;
+};
+
+/* Returns the columns of the indexes which the database reports for
+ * the given table.
+ */
+QList<QStringList> QDjangoIndexAdvisorPrivate::databaseIndexes(const QSqlDatabase &db, const QString &table) const
+{
+    QList<QStringList> indexes;
+    QSqlQuery query(db);
+    QMap<QString, QStringList> columns;
+
+    switch (QDjangoDatabase::databaseType(db)) {
+    case QDjangoDatabase::SQLite: {
+        const QString escapedTable = db.driver()->escapeIdentifier(table, QSqlDriver::TableName);
+        if (!query.exec(QLatin1String("PRAGMA index_list(") + escapedTable + QLatin1Char(')')))
+            return indexes;
+        QStringList names;
+        while (query.next())
+            names << query.value(query.record().indexOf(QLatin1String("name"))).toString();
+        foreach (const QString &name, names) {
+            QSqlQuery info(db);
+            if (!info.exec(QLatin1String("PRAGMA index_info(") + db.driver()->escapeIdentifier(name, QSqlDriver::TableName) + QLatin1Char(')')))
+                continue;
+            QStringList indexColumns;
+            while (info.next())
+                indexColumns << info.value(info.record().indexOf(QLatin1String("name"))).toString();
+            indexes << indexColumns;
+        }
+        return indexes;
+    }
+    case QDjangoDatabase::PostgreSQL:
+        query.prepare(QLatin1String(
+            "SELECT i.relname, a.attname FROM pg_index x "
+            "JOIN pg_class c ON c.oid = x.indrelid "
+            "JOIN pg_class i ON i.oid = x.indexrelid "
+            "CROSS JOIN LATERAL unnest(x.indkey) WITH ORDINALITY AS k(attnum, n) "
+            "JOIN pg_attribute a ON a.attrelid = c.oid AND a.attnum = k.attnum "
+            "WHERE c.relname = ? ORDER BY i.relname, k.n"));
+        break;
+    case QDjangoDatabase::MySqlServer:
+        query.prepare(QLatin1String(
+            "SELECT INDEX_NAME, COLUMN_NAME FROM information_schema.STATISTICS "
+            "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? "
+            "ORDER BY INDEX_NAME, SEQ_IN_INDEX"));
+        break;
+    default:
+        return indexes;
+    }
+
+    query.addBindValue(table);
+    if (!query.exec())
+        return indexes;
+    QStringList names;
+    while (query.next()) {
+        const QString name = query.value(0).toString();
+        if (!columns.contains(name))
+            names << name;
+        columns[name] << query.value(1).toString();
+    }
+    foreach (const QString &name, names)
+        indexes << columns.value(name);
+    return indexes;
+}
+
+/* Breaks a statement generated by QDjango down into the columns which
+ * an index could serve: the columns filtered on, followed by the columns
+ * the main table is ordered by, and each column used by a join.
+ */
+QList<QDjangoIndexUsage> QDjangoIndexAdvisorPrivate::parse(const QString &sql)
+{
+    QList<QDjangoIndexUsage> usages;
+    const QString verb = sql.trimmed().section(QLatin1Char(' '), 0, 0).toUpper();
+    if (verb != QLatin1String("SELECT") &&
+        verb != QLatin1String("UPDATE") &&
+        verb != QLatin1String("DELETE"))
+        return usages;
+
+    const QString ident = QLatin1String(identifierPattern);
+
+    // tables and their aliases
+    QMap<QString, QString> tables;
+    QString baseTable;
+    QRegExp tableRx(QLatin1String("\\b(?:FROM|JOIN|UPDATE)\\s+") + ident + QLatin1String("(?:\\s+(T\\w*\\d))?"));
+    int pos = 0;
+    while ((pos = tableRx.indexIn(sql, pos)) != -1) {
+        const QString table = identifier(tableRx, 1);
+        tables.insert(table, table);
+        if (!tableRx.cap(5).isEmpty())
+            tables.insert(tableRx.cap(5), table);
+        if (baseTable.isEmpty())
+            baseTable = table;
+        pos += tableRx.matchedLength();
+    }
+
+    // classify each column reference by the clause it appears in
+    static const char *clauses[] = {" WHERE ", " ORDER BY ", " ON ", " SET ", "SELECT ", " FROM ", 0};
+    QMap<QString, QStringList> filters;
+    QStringList orders;
+    QList<QDjangoIndexUsage> joins;
+    QRegExp columnRx(ident + QLatin1String("\\.") + ident);
+    pos = 0;
+    while ((pos = columnRx.indexIn(sql, pos)) != -1) {
+        const QString table = tables.value(identifier(columnRx, 1));
+        const QString column = identifier(columnRx, 5);
+        const int end = pos + columnRx.matchedLength();
+
+        int clausePos = -1;
+        QString clause;
+        for (int i = 0; clauses[i]; ++i) {
+            const int found = sql.lastIndexOf(QLatin1String(clauses[i]), pos);
+            if (found > clausePos) {
+                clausePos = found;
+                clause = QLatin1String(clauses[i]);
+            }
+        }
+
+        if (table.isEmpty()) {
+            // not a table reference
+        } else if (clause == QLatin1String(" WHERE ")) {
+            if (!filters[table].contains(column))
+                filters[table] << column;
+        } else if (clause == QLatin1String(" ORDER BY ")) {
+            if (table == baseTable) {
+                const bool descending = sql.mid(end, 5) == QLatin1String(" DESC");
+                orders << (descending ? QLatin1String("-") + column : column);
+            }
+        } else if (clause == QLatin1String(" ON ")) {
+            QDjangoIndexUsage usage;
+            usage.table = table;
+            usage.columns << column;
+            joins << usage;
+        }
+        pos = end;
+    }
+
+    QMap<QString, QStringList>::const_iterator it;
+    for (it = filters.constBegin(); it != filters.constEnd(); ++it) {
+        QDjangoIndexUsage usage;
+        usage.table = it.key();
+        usage.columns = it.value();
+        if (usage.table == baseTable) {
+            foreach (const QString &order, orders) {
+                const QString column = order.startsWith(QLatin1Char('-')) ? order.mid(1) : order;
+                if (!usage.columns.contains(column))
+                    usage.columns << order;
+            }
+        }
+        usages << usage;
+    }
+    if (!orders.isEmpty() && !filters.contains(baseTable)) {
+        QDjangoIndexUsage usage;
+        usage.table = baseTable;
+        usage.columns = orders;
+        usages << usage;
+    }
+    usages << joins;
+    return usages;
+}
+
+/* Returns true if the given columns are the leading columns of one of
+ * the indexes, in any order.
+ */
+static bool isCovered(const QStringList &columns, const QList<QStringList> &indexes)
+{
+    QStringList names;
+    foreach (const QString &column, columns)
+        names << (column.startsWith(QLatin1Char('-')) ? column.mid(1) : column);
+    names.sort();
+
+    foreach (const QStringList &index, indexes) {
+        if (index.size() < names.size())
+            continue;
+        QStringList leading = index.mid(0, names.size());
+        leading.sort();
+        if (leading == names)
+            return true;
+    }
+    return false;
+}
+
+/// \endcond
+
+/*!
+    Constructs an empty Suggestion.
+*/
+QDjangoIndexAdvisor::Suggestion::Suggestion()
+    : count(0)
+    , time(0)
+{
+}
+
+/*!
+    Constructs a new index advisor.
+*/
+QDjangoIndexAdvisor::QDjangoIndexAdvisor()
+    : d(new QDjangoIndexAdvisorPrivate)
+{
+}
+
+/*!
+    Destroys the index advisor.
+
+    You must remove it from the query observers before destroying it.
+*/
+QDjangoIndexAdvisor::~QDjangoIndexAdvisor()
+{
+    delete d;
+}
+
+/*!
+    Forgets the statements recorded so far.
+*/
+void QDjangoIndexAdvisor::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->statements.clear();
+}
+
+/*!
+    Returns the suggested indexes, with those which would serve the most
+    time consuming statements first.
+
+    If \a checkDatabase is true, the indexes reported by the database are
+    taken into account in addition to those declared by the models.
+*/
+QList<QDjangoIndexAdvisor::Suggestion> QDjangoIndexAdvisor::suggestions(bool checkDatabase) const
+{
+    QHash<QString, QDjangoStatementStats> statements;
+    {
+        QMutexLocker locker(&d->mutex);
+        statements = d->statements;
+    }
+
+    // aggregate the usages of all statements
+    QMap<QString, Suggestion> candidates;
+    foreach (const QDjangoStatementStats &stats, statements) {
+        foreach (const QDjangoIndexUsage &usage, QDjangoIndexAdvisorPrivate::parse(stats.sql)) {
+            const QString key = usage.table + QLatin1Char(':') + usage.columns.join(QLatin1String(","));
+            Suggestion &candidate = candidates[key];
+            candidate.table = usage.table;
+            candidate.columns = usage.columns;
+            candidate.count += stats.count;
+            candidate.time += stats.time;
+        }
+    }
+
+    // existing indexes
+    QSqlDatabase db = QDjango::database();
+    QMap<QString, QList<QStringList> > indexes;
+    QSet<QString> checkedTables;
+    foreach (const QDjangoMetaModel &metaModel, QDjango::metaModels())
+        indexes[metaModel.table()] << metaModel.indexedColumns();
+
+    QList<Suggestion> result;
+    QSqlDriver *driver = db.driver();
+    foreach (Suggestion candidate, candidates) {
+        if (checkDatabase && !checkedTables.contains(candidate.table)) {
+            indexes[candidate.table] << d->databaseIndexes(db, candidate.table);
+            checkedTables << candidate.table;
+        }
+        if (isCovered(candidate.columns, indexes.value(candidate.table)))
+            continue;
+
+        QStringList columns;
+        foreach (const QString &column, candidate.columns) {
+            if (column.startsWith(QLatin1Char('-')))
+                columns << driver->escapeIdentifier(column.mid(1), QSqlDriver::FieldName) + QLatin1String(" DESC");
+            else
+                columns << driver->escapeIdentifier(column, QSqlDriver::FieldName);
+        }
+        const QString indexName = QDjangoMetaModel::indexName(candidate.table, candidate.columns);
+        candidate.sql = QString::fromLatin1("CREATE INDEX %1 ON %2 (%3)").arg(
+            driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
+            driver->escapeIdentifier(candidate.table, QSqlDriver::TableName),
+            columns.join(QLatin1String(", ")));
+        result << candidate;
+    }
+
+    qSort(result.begin(), result.end(), lessThanTime);
+    return result;
+}
+
+/*!
+    Records the statement described by \a event.
+*/
+void QDjangoIndexAdvisor::queryExecuted(const QDjangoQueryEvent &event)
+{
+    if (!event.success)
+        return;
+
+    QMutexLocker locker(&d->mutex);
+    QDjangoStatementStats &stats = d->statements[event.fingerprint];
+    if (stats.sql.isEmpty())
+        stats.sql = event.fingerprint;
+    stats.count++;
+    stats.time += event.executionTime + event.fetchTime;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_INDEX_ADVISOR_H
+#define QDJANGO_INDEX_ADVISOR_H
+
+#include <QList>
+#include <QStringList>
+
+#include "QDjangoQueryObserver.h"
+
+class QDjangoIndexAdvisorPrivate;
+
+/** \brief The QDjangoIndexAdvisor class suggests indexes from the SQL
+ *  statements executed by QDjango.
+ *
+ *  Once installed as a query observer, it records for every statement
+ *  fingerprint how often it ran and how long it took. When suggestions()
+ *  is called, the statements are broken down into the columns filtered,
+ *  ordered and joined on for each table. Column sets which are not already
+ *  the leading columns of an index, either declared by the models or
+ *  reported by the database, are returned as CREATE INDEX statements.
+ *
+ *  \code
+ *  QDjangoIndexAdvisor advisor;
+ *  QDjango::addQueryObserver(&advisor);
+ *  runWorkload();
+ *  QDjango::removeQueryObserver(&advisor);
+ *  foreach (const QDjangoIndexAdvisor::Suggestion &suggestion, advisor.suggestions())
+ *      qDebug() << suggestion.sql << suggestion.count << suggestion.time;
+ *  \endcode
+ *
+ *  Statements are only recorded, not analysed, as they execute, so the
+ *  advisor can be left installed during a whole run.
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoIndexAdvisor : public QDjangoQueryObserver
+{
+public:
+    /** \brief The Suggestion class describes a suggested index.
+     */
+    class Suggestion
+    {
+    public:
+        Suggestion();
+
+        /** The table to index. */
+        QString table;
+
+        /** The columns to index, prefixed with '-' for descending order. */
+        QStringList columns;
+
+        /** The number of statements which would use the index. */
+        int count;
+
+        /** The time spent executing and fetching those statements, in
+         *  nanoseconds. */
+        qint64 time;
+
+        /** The CREATE INDEX statement for the current database. */
+        QString sql;
+    };
+
+    QDjangoIndexAdvisor();
+    ~QDjangoIndexAdvisor();
+
+    void clear();
+    QList<Suggestion> suggestions(bool checkDatabase = true) const;
+
+    void queryExecuted(const QDjangoQueryEvent &event);
+
+private:
+    Q_DISABLE_COPY(QDjangoIndexAdvisor)
+    QDjangoIndexAdvisorPrivate* const d;
+};
+
+#endif
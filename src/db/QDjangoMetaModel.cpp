@@ -16,9 +16,13 @@
  */
 
 #include <QDebug>
+#include <QHash>
 #include <QMetaProperty>
+#include <QReadWriteLock>
+#include <QSharedPointer>
 #include <QSqlDriver>
 #include <QStringList>
+#include <QVector>
 
 #include "QDjango.h"
 #include "QDjangoMetaModel.h"
@@ -75,6 +79,7 @@ public:
     QDjangoMetaFieldPrivate();
 
     bool autoIncrement;
+    bool caseInsensitive;
     QString db_column;
     QByteArray foreignModel;
     bool index;
@@ -89,6 +94,7 @@ public:
 
 QDjangoMetaFieldPrivate::QDjangoMetaFieldPrivate()
     : autoIncrement(false)
+    , caseInsensitive(false)
     , index(false)
     , maxLength(0)
     , null(false)
@@ -210,12 +216,28 @@ QVariant QDjangoMetaField::toDatabase(const QVariant &value) const
 
 static QMap<QString, QString> parseOptions(const char *value)
 {
+    // options are separated by spaces, unless they are within a double
+    // quoted value such as index_together="a,b?a IS NOT NULL"
+    QStringList items;
+    QString current;
+    bool quoted = false;
+    foreach (const QChar &c, QString::fromLatin1(value)) {
+        if (c == QLatin1Char('"')) {
+            quoted = !quoted;
+        } else if (c == QLatin1Char(' ') && !quoted) {
+            items << current;
+            current.clear();
+        } else {
+            current += c;
+        }
+    }
+    items << current;
+
     QMap<QString, QString> options;
-    QStringList items = QString::fromLatin1(value).split(QLatin1Char(' '));
     foreach (const QString &item, items) {
-        QStringList assign = item.split(QLatin1Char('='));
-        if (assign.size() == 2) {
-            options[assign[0].toLower()] = assign[1];
+        const int pos = item.indexOf(QLatin1Char('='));
+        if (pos > 0) {
+            options[item.left(pos).toLower()] = item.mid(pos + 1);
         } else {
             qWarning() << "Could not parse option" << item;
         }
@@ -228,33 +250,366 @@ static bool stringToBool(const QString &value)
     return value.toLower() == QLatin1String("true") || value == QLatin1String("1");
 }
 
+// a composite index declared with index_together
+
+class QDjangoMetaIndex
+{
+public:
+    QList<QByteArray> fields;
+    QList<bool> descending;
+    QList<QByteArray> include;
+    QString where;
+};
+
+/* Parses the groups of an index_together option, which are separated by
+ * semicolons. Each group lists its fields separated by commas, prefixed
+ * with '-' for descending order, optionally followed by '+' and the
+ * fields covered by the index, then by '?' and the predicate of a
+ * partial index:
+ *
+ *   index_together="last_name,-date_joined+email?is_active = 1;username,email"
+ */
+static QList<QDjangoMetaIndex> parseIndexes(const QString &value)
+{
+    QList<QDjangoMetaIndex> indexes;
+    foreach (const QString &group, value.split(QLatin1Char(';'), QString::SkipEmptyParts)) {
+        QDjangoMetaIndex index;
+        QString spec = group;
+
+        const int wherePos = spec.indexOf(QLatin1Char('?'));
+        if (wherePos >= 0) {
+            index.where = spec.mid(wherePos + 1).trimmed();
+            spec = spec.left(wherePos);
+        }
+
+        const int includePos = spec.indexOf(QLatin1Char('+'));
+        if (includePos >= 0) {
+            foreach (const QString &name, spec.mid(includePos + 1).split(QLatin1Char(','), QString::SkipEmptyParts))
+                index.include << name.trimmed().toLatin1();
+            spec = spec.left(includePos);
+        }
+
+        foreach (const QString &name, spec.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+            const QString field = name.trimmed();
+            const bool descending = field.startsWith(QLatin1Char('-'));
+            index.fields << (descending ? field.mid(1) : field).toLatin1();
+            index.descending << descending;
+        }
+
+        if (index.fields.isEmpty())
+            qWarning() << "Could not parse index" << group;
+        else
+            indexes << index;
+    }
+    return indexes;
+}
+
+// escaped table and column names for each driver, which are never
+// changed once inserted so that references to them remain valid
+
+class QDjangoMetaModelIdentifierCache
+{
+public:
+    ~QDjangoMetaModelIdentifierCache()
+    {
+        qDeleteAll(drivers);
+    }
+
+    QReadWriteLock lock;
+    QMap<QString, QDjangoMetaModelIdentifiers*> drivers;
+};
+
+// a foreign key, with the names of its dynamic companion properties
+
+class QDjangoMetaForeignKey
+{
+public:
+    QByteArray name;
+    QByteArray model;
+    QByteArray idName;
+    QByteArray ptrName;
+};
+
 class QDjangoMetaModelPrivate : public QSharedData
 {
 public:
+    QDjangoMetaModelPrivate()
+        : metaObject(0)
+        , primaryKeyIndex(-1)
+        , identifiers(new QDjangoMetaModelIdentifierCache)
+    {
+    }
+
+    void addField(const QByteArray &name, QVariant::Type type, const QByteArray &foreignModel, const char *options);
+    int fieldIndex(const char *name) const;
+    const QDjangoMetaModelIdentifiers &escapedIdentifiers(const QSqlDatabase &db) const;
+
+    bool isTyped(const QObject *model) const;
+    QVariant fieldValue(const QObject *model, int index) const;
+    QVariantList fieldValues(const QObject *model) const;
+    void setFieldValue(QObject *model, int index, const QVariant &value) const;
+    QVariant typedFieldValue(const void *model, int index) const;
+    QVariantList typedFieldValues(const void *model) const;
+    QVariantMap insertFields(const QVariantList &values) const;
+
+    const QMetaObject *metaObject;
     QString className;
     QList<QDjangoMetaField> localFields;
     QMap<QByteArray, QByteArray> foreignFields;
     QByteArray primaryKey;
     QString table;
     QList<QByteArray> uniqueTogether;
+    QList<QDjangoMetaIndex> indexTogether;
+
+    // position of each field in localFields
+    QHash<QByteArray, int> fieldIndexes;
+    int primaryKeyIndex;
+
+    // the meta property of each field in localFields, which is invalid
+    // for foreign key ids as they are dynamic properties
+    QList<QMetaProperty> fieldProperties;
+
+    // the foreign keys, in the same order as foreignFields
+    QList<QDjangoMetaForeignKey> foreignKeys;
+
+    // typed accessors from the model descriptor, if any, with the position
+    // in the descriptor of each local field and the reverse mapping
+    QDjangoModelAccessor accessor;
+    QVector<int> accessorFields;
+    QVector<int> accessorColumns;
+
+    // shared by all copies of the meta model
+    QSharedPointer<QDjangoMetaModelIdentifierCache> identifiers;
 };
 
+int QDjangoMetaModelPrivate::fieldIndex(const char *name) const
+{
+    if (!strcmp(name, "pk"))
+        return primaryKeyIndex;
+    return fieldIndexes.value(QByteArray::fromRawData(name, qstrlen(name)), -1);
+}
+
+const QDjangoMetaModelIdentifiers &QDjangoMetaModelPrivate::escapedIdentifiers(const QSqlDatabase &db) const
+{
+    const QString driverName = db.driverName();
+    {
+        QReadLocker locker(&identifiers->lock);
+        const QDjangoMetaModelIdentifiers *escaped = identifiers->drivers.value(driverName);
+        if (escaped)
+            return *escaped;
+    }
+
+    QWriteLocker locker(&identifiers->lock);
+    QDjangoMetaModelIdentifiers *&escaped = identifiers->drivers[driverName];
+    if (!escaped) {
+        QSqlDriver *driver = db.driver();
+        escaped = new QDjangoMetaModelIdentifiers;
+        escaped->table = driver->escapeIdentifier(table, QSqlDriver::TableName);
+        foreach (const QDjangoMetaField &field, localFields)
+            escaped->columns << driver->escapeIdentifier(field.column(), QSqlDriver::FieldName);
+    }
+    return *escaped;
+}
+
+void QDjangoMetaModelPrivate::addField(const QByteArray &name, QVariant::Type type, const QByteArray &foreignModel, const char *optionString)
+{
+    // parse field options
+    bool autoIncrementOption = false;
+    bool caseInsensitiveOption = false;
+    QString dbColumnOption;
+    bool dbIndexOption = false;
+    bool ignoreFieldOption = false;
+    int maxLengthOption = 0;
+    bool primaryKeyOption = false;
+    bool nullOption = false;
+    bool uniqueOption = false;
+    bool blankOption = false;
+    ForeignKeyConstraint deleteConstraint = NoAction;
+    if (optionString && *optionString)
+    {
+        QMap<QString, QString> options = parseOptions(optionString);
+        QMapIterator<QString, QString> option(options);
+        while (option.hasNext()) {
+            option.next();
+            const QString key = option.key();
+            const QString value = option.value();
+            if (key == QLatin1String("auto_increment"))
+                autoIncrementOption = stringToBool(value);
+            else if (key == QLatin1String("case_insensitive"))
+                caseInsensitiveOption = stringToBool(value);
+            else if (key == QLatin1String("db_column"))
+                dbColumnOption = value;
+            else if (key == QLatin1String("db_index"))
+                dbIndexOption = stringToBool(value);
+            else if (key == QLatin1String("ignore_field"))
+                ignoreFieldOption = stringToBool(value);
+            else if (key == QLatin1String("max_length"))
+                maxLengthOption = value.toInt();
+            else if (key == QLatin1String("null"))
+                nullOption = stringToBool(value);
+            else if (key == QLatin1String("primary_key"))
+                primaryKeyOption = stringToBool(value);
+            else if (key == QLatin1String("unique"))
+                uniqueOption = stringToBool(value);
+            else if (key == QLatin1String("blank"))
+                blankOption = stringToBool(value);
+            else if (option.key() == "on_delete") {
+                if (value.toLower() == "cascade")
+                    deleteConstraint = Cascade;
+                else if (value.toLower() == "set_null")
+                    deleteConstraint = SetNull;
+                else if (value.toLower() == "restrict")
+                    deleteConstraint = Restrict;
+            }
+        }
+    }
+
+    // ignore field
+    if (ignoreFieldOption)
+        return;
+
+    // foreign field
+    if (!foreignModel.isEmpty()) {
+        foreignFields.insert(name, foreignModel);
+
+        QDjangoMetaField field;
+        field.d->name = name + "_id";
+        // FIXME : the key is not necessarily an INTEGER field, we should
+        // probably perform a lookup on the foreign model, but are we sure
+        // it is already registered?
+        field.d->type = QVariant::Int;
+        field.d->foreignModel = foreignModel;
+        field.d->db_column = dbColumnOption.isEmpty() ? QString::fromLatin1(field.d->name) : dbColumnOption;
+        field.d->index = true;
+        field.d->null = nullOption;
+        field.d->deleteConstraint = deleteConstraint;
+        localFields << field;
+        return;
+    }
+
+    // local field
+    QDjangoMetaField field;
+    field.d->name = name;
+    field.d->type = type;
+    field.d->db_column = dbColumnOption.isEmpty() ? QString::fromLatin1(field.d->name) : dbColumnOption;
+    field.d->maxLength = maxLengthOption;
+    field.d->null = nullOption;
+    field.d->caseInsensitive = caseInsensitiveOption && type == QVariant::String;
+    if (primaryKeyOption) {
+        field.d->autoIncrement = autoIncrementOption;
+        primaryKey = field.d->name;
+    } else if (uniqueOption) {
+        field.d->unique = true;
+    } else if (blankOption) {
+        field.d->blank = true;
+    } else if (dbIndexOption) {
+        field.d->index = true;
+    }
+
+    localFields << field;
+}
+
+bool QDjangoMetaModelPrivate::isTyped(const QObject *model) const
+{
+    return accessor.load && model->metaObject() == metaObject;
+}
+
+QVariant QDjangoMetaModelPrivate::fieldValue(const QObject *model, int index) const
+{
+    if (isTyped(model) && accessorFields.at(index) >= 0)
+        return typedFieldValue(model, index);
+    return model->property(localFields.at(index).d->name);
+}
+
+QVariantList QDjangoMetaModelPrivate::fieldValues(const QObject *model) const
+{
+    QVariantList values;
+    if (isTyped(model)) {
+        values = typedFieldValues(model);
+        for (int i = 0; i < localFields.size(); ++i) {
+            if (accessorFields.at(i) < 0)
+                values[i] = model->property(localFields.at(i).d->name);
+        }
+    } else {
+        values.reserve(localFields.size());
+        foreach (const QDjangoMetaField &field, localFields)
+            values << model->property(field.d->name);
+    }
+    return values;
+}
+
+QVariant QDjangoMetaModelPrivate::typedFieldValue(const void *model, int index) const
+{
+    const int k = accessorFields.value(index, -1);
+    if (k < 0)
+        return QVariant();
+    const QDjangoModelAccessor::Field &field = accessor.fields.at(k);
+    return field.value(model, field.slot);
+}
+
+// returns the values of the local fields read through the model descriptor,
+// leaving those it does not list null
+
+QVariantList QDjangoMetaModelPrivate::typedFieldValues(const void *model) const
+{
+    QVariantList typed;
+    typed.reserve(accessorColumns.size());
+    accessor.read(model, typed);
+
+    QVariantList values;
+    values.reserve(localFields.size());
+    for (int i = 0; i < localFields.size(); ++i) {
+        const int k = accessorFields.at(i);
+        values << (k >= 0 ? typed.at(k) : QVariant());
+    }
+    return values;
+}
+
+// returns the values to INSERT for the given local field values
+
+QVariantMap QDjangoMetaModelPrivate::insertFields(const QVariantList &values) const
+{
+    QVariantMap fields;
+    for (int i = 0; i < localFields.size(); ++i) {
+        const QDjangoMetaField &field = localFields.at(i);
+        if (!field.d->autoIncrement)
+            fields.insert(field.name(), field.toDatabase(values.at(i)));
+    }
+    return fields;
+}
+
+void QDjangoMetaModelPrivate::setFieldValue(QObject *model, int index, const QVariant &value) const
+{
+    if (isTyped(model) && accessorFields.at(index) >= 0) {
+        const QDjangoModelAccessor::Field &field = accessor.fields.at(accessorFields.at(index));
+        field.setValue(model, field.slot, value);
+    } else
+        model->setProperty(localFields.at(index).d->name, value);
+}
+
 /*!
     Constructs a new QDjangoMetaModel by inspecting the given \a meta model.
+
+    If \a accessor was generated from a QDjangoModelDescriptor, the fields
+    are those listed by the descriptor and they are read and written
+    through its typed accessors. Otherwise the fields are the properties
+    declared by the model.
 */
-QDjangoMetaModel::QDjangoMetaModel(const QMetaObject *meta)
+QDjangoMetaModel::QDjangoMetaModel(const QMetaObject *meta, const QDjangoModelAccessor &accessor)
     : d(new QDjangoMetaModelPrivate)
 {
-    if (!meta)
+    if (!meta && !accessor.load)
         return;
 
-    d->className = meta->className();
-    d->table = QString::fromLatin1(meta->className()).toLower();
+    d->metaObject = meta;
+    d->className = meta ? QString::fromLatin1(meta->className()) : QString::fromLatin1(accessor.className);
+    d->table = d->className.toLower();
 
     // parse table options
-    const int optionsIndex = meta->indexOfClassInfo("__meta__");
-    if (optionsIndex >= 0) {
-        QMap<QString, QString> options = parseOptions(meta->classInfo(optionsIndex).value());
+    const int optionsIndex = meta ? meta->indexOfClassInfo("__meta__") : -1;
+    const char *tableOptions = meta ? (optionsIndex >= 0 ? meta->classInfo(optionsIndex).value() : 0) : accessor.options;
+    if (tableOptions && *tableOptions) {
+        QMap<QString, QString> options = parseOptions(tableOptions);
         QMapIterator<QString, QString> option(options);
         while (option.hasNext()) {
             option.next();
@@ -262,119 +617,42 @@ QDjangoMetaModel::QDjangoMetaModel(const QMetaObject *meta)
                 d->table = option.value();
             else if (option.key() == QLatin1String("unique_together"))
                 d->uniqueTogether = option.value().toLatin1().split(',');
+            else if (option.key() == QLatin1String("index_together"))
+                d->indexTogether = parseIndexes(option.value());
         }
     }
 
-    const int count = meta->propertyCount();
-    int start = 0;
-
-    for(const QMetaObject *superClass = meta; superClass; superClass = superClass->superClass())
-    {
-        start = superClass->propertyCount();
-        if(superClass->className()[0] == 'Q')
-        {
-            break;
-        }
-    }
-    for(int i = start; i < count; ++i)
-    {
-        const QString typeName = QString::fromLatin1(meta->property(i).typeName());
-        if (!qstrcmp(meta->property(i).name(), "pk"))
-            continue;
+    if (accessor.load) {
+        // fields listed by the model descriptor
+        d->accessor = accessor;
+        foreach (const QDjangoModelAccessor::Field &field, accessor.fields)
+            d->addField(field.name, QVariant::Type(field.type), QByteArray(), field.options);
+    } else {
+        // fields declared as properties
+        const int count = meta->propertyCount();
+        int start = 0;
 
-        // parse field options
-        bool autoIncrementOption = false;
-        QString dbColumnOption;
-        bool dbIndexOption = false;
-        bool ignoreFieldOption = false;
-        int maxLengthOption = 0;
-        bool primaryKeyOption = false;
-        bool nullOption = false;
-        bool uniqueOption = false;
-        bool blankOption = false;
-        ForeignKeyConstraint deleteConstraint = NoAction;
-        const int infoIndex = meta->indexOfClassInfo(meta->property(i).name());
-        if (infoIndex >= 0)
+        for(const QMetaObject *superClass = meta; superClass; superClass = superClass->superClass())
         {
-            QMap<QString, QString> options = parseOptions(meta->classInfo(infoIndex).value());
-            QMapIterator<QString, QString> option(options);
-            while (option.hasNext()) {
-                option.next();
-                const QString key = option.key();
-                const QString value = option.value();
-                if (key == QLatin1String("auto_increment"))
-                    autoIncrementOption = stringToBool(value);
-                else if (key == QLatin1String("db_column"))
-                    dbColumnOption = value;
-                else if (key == QLatin1String("db_index"))
-                    dbIndexOption = stringToBool(value);
-                else if (key == QLatin1String("ignore_field"))
-                    ignoreFieldOption = stringToBool(value);
-                else if (key == QLatin1String("max_length"))
-                    maxLengthOption = value.toInt();
-                else if (key == QLatin1String("null"))
-                    nullOption = stringToBool(value);
-                else if (key == QLatin1String("primary_key"))
-                    primaryKeyOption = stringToBool(value);
-                else if (key == QLatin1String("unique"))
-                    uniqueOption = stringToBool(value);
-                else if (key == QLatin1String("blank"))
-                    blankOption = stringToBool(value);
-                else if (option.key() == "on_delete") {
-                    if (value.toLower() == "cascade")
-                        deleteConstraint = Cascade;
-                    else if (value.toLower() == "set_null")
-                        deleteConstraint = SetNull;
-                    else if (value.toLower() == "restrict")
-                        deleteConstraint = Restrict;
-                }
+            start = superClass->propertyCount();
+            if(superClass->className()[0] == 'Q')
+            {
+                break;
             }
         }
-
-        // ignore field
-        if (ignoreFieldOption)
-            continue;
-
-        // foreign field
-        if (typeName.endsWith(QLatin1Char('*'))) {
-            const QByteArray fkName = meta->property(i).name();
-            const QByteArray fkModel = typeName.left(typeName.size() - 1).toLatin1();
-            d->foreignFields.insert(fkName, fkModel);
-
-            QDjangoMetaField field;
-            field.d->name = fkName + "_id";
-            // FIXME : the key is not necessarily an INTEGER field, we should
-            // probably perform a lookup on the foreign model, but are we sure
-            // it is already registered?
-            field.d->type = QVariant::Int;
-            field.d->foreignModel = fkModel;
-            field.d->db_column = dbColumnOption.isEmpty() ? QString::fromLatin1(field.d->name) : dbColumnOption;
-            field.d->index = true;
-            field.d->null = nullOption;
-            field.d->deleteConstraint = deleteConstraint;
-            d->localFields << field;
-            continue;
-        }
-
-        // local field
-        QDjangoMetaField field;
-        field.d->name = meta->property(i).name();
-        field.d->type = meta->property(i).type();
-        field.d->db_column = dbColumnOption.isEmpty() ? QString::fromLatin1(field.d->name) : dbColumnOption;
-        field.d->maxLength = maxLengthOption;
-        field.d->null = nullOption;
-        if (primaryKeyOption) {
-            field.d->autoIncrement = autoIncrementOption;
-            d->primaryKey = field.d->name;
-        } else if (uniqueOption) {
-            field.d->unique = true;
-        } else if (blankOption) {
-            field.d->blank = true;
-        } else if (dbIndexOption) {
-            field.d->index = true;
+        for(int i = start; i < count; ++i)
+        {
+            const QMetaProperty property = meta->property(i);
+            if (!qstrcmp(property.name(), "pk"))
+                continue;
+
+            const QString typeName = QString::fromLatin1(property.typeName());
+            const QByteArray foreignModel = typeName.endsWith(QLatin1Char('*')) ?
+                typeName.left(typeName.size() - 1).toLatin1() : QByteArray();
+            const int infoIndex = meta->indexOfClassInfo(property.name());
+            d->addField(property.name(), property.type(), foreignModel,
+                        infoIndex >= 0 ? meta->classInfo(infoIndex).value() : 0);
         }
-
-        d->localFields << field;
     }
 
     // automatic primary key
@@ -388,6 +666,37 @@ QDjangoMetaModel::QDjangoMetaModel(const QMetaObject *meta)
         d->primaryKey = field.d->name;
     }
 
+    // index fields by name
+    d->fieldIndexes.reserve(d->localFields.size());
+    for (int i = 0; i < d->localFields.size(); ++i) {
+        const QByteArray name = d->localFields.at(i).d->name;
+        d->fieldIndexes.insert(name, i);
+        const int propertyIndex = meta ? meta->indexOfProperty(name) : -1;
+        d->fieldProperties << (propertyIndex >= 0 ? meta->property(propertyIndex) : QMetaProperty());
+    }
+    d->primaryKeyIndex = d->fieldIndexes.value(d->primaryKey, -1);
+
+    // map the descriptor fields to local fields
+    if (d->accessor.load) {
+        d->accessorFields.fill(-1, d->localFields.size());
+        for (int k = 0; k < d->accessor.fields.size(); ++k) {
+            const int index = d->fieldIndexes.value(d->accessor.fields.at(k).name, -1);
+            d->accessorColumns << index;
+            if (index >= 0)
+                d->accessorFields[index] = k;
+        }
+    }
+
+    // precompute the names of the foreign key companion properties
+    QMap<QByteArray, QByteArray>::const_iterator fk;
+    for (fk = d->foreignFields.constBegin(); fk != d->foreignFields.constEnd(); ++fk) {
+        QDjangoMetaForeignKey foreignKey;
+        foreignKey.name = fk.key();
+        foreignKey.model = fk.value();
+        foreignKey.idName = fk.key() + "_id";
+        foreignKey.ptrName = fk.key() + "_ptr";
+        d->foreignKeys << foreignKey;
+    }
 }
 
 /*!
@@ -639,14 +948,82 @@ QStringList QDjangoMetaModel::createTableSql() const
     // create indices
     foreach (const QDjangoMetaField &field, d->localFields) {
         if (field.d->index) {
-            const QString indexName = d->table + QLatin1Char('_')
-                + stringlist_digest(QStringList() << field.column());
+            const QString indexName = QDjangoMetaModel::indexName(d->table, QStringList() << field.column());
             queries << QString::fromLatin1("CREATE INDEX %1 ON %2 (%3)").arg(
                 // FIXME : how should we escape an index name?
                 driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
                 quotedTable,
                 driver->escapeIdentifier(field.column(), QSqlDriver::FieldName));
         }
+
+        // case-insensitive lookups compare lower-cased values on PostgreSQL,
+        // other databases use a case-insensitive collation or LIKE
+        if (field.d->caseInsensitive && databaseType == QDjangoDatabase::PostgreSQL) {
+            const QString expression = QLatin1String("lower(")
+                + driver->escapeIdentifier(field.column(), QSqlDriver::FieldName) + QLatin1Char(')');
+            const QString indexName = QDjangoMetaModel::indexName(d->table,
+                QStringList() << QLatin1String("lower(") + field.column() + QLatin1Char(')'));
+            queries << QString::fromLatin1("CREATE INDEX %1 ON %2 (%3)").arg(
+                driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
+                quotedTable,
+                expression);
+        }
+    }
+
+    // create composite indices
+    foreach (const QDjangoMetaIndex &index, d->indexTogether) {
+        QStringList digestParts;
+        QStringList columns;
+        QStringList includeColumns;
+        bool valid = true;
+        for (int i = 0; i < index.fields.size(); ++i) {
+            const QDjangoMetaField field = localField(index.fields.at(i));
+            valid = valid && field.isValid();
+            QString column = driver->escapeIdentifier(field.column(), QSqlDriver::FieldName);
+            if (index.descending.at(i))
+                column += QLatin1String(" DESC");
+            columns << column;
+            if (index.descending.at(i))
+                digestParts << QLatin1String("-") + field.column();
+            else
+                digestParts << field.column();
+        }
+        foreach (const QByteArray &name, index.include) {
+            const QDjangoMetaField field = localField(name);
+            valid = valid && field.isValid();
+            includeColumns << driver->escapeIdentifier(field.column(), QSqlDriver::FieldName);
+            digestParts << QLatin1String("+") + field.column();
+        }
+        if (!index.where.isEmpty())
+            digestParts << QLatin1String("?") + index.where;
+        if (!valid) {
+            qWarning() << "Invalid index" << digestParts << "for model" << d->className;
+            continue;
+        }
+
+        // covering columns are only supported by PostgreSQL and SQL Server,
+        // other databases get them appended to the indexed columns
+        if (!includeColumns.isEmpty() &&
+            databaseType != QDjangoDatabase::PostgreSQL &&
+            databaseType != QDjangoDatabase::MSSqlServer) {
+            columns << includeColumns;
+            includeColumns.clear();
+        }
+        const QString indexName = QDjangoMetaModel::indexName(d->table, digestParts);
+        QString indexSql = QString::fromLatin1("CREATE INDEX %1 ON %2 (%3)").arg(
+            driver->escapeIdentifier(indexName, QSqlDriver::FieldName),
+            quotedTable,
+            columns.join(QLatin1String(", ")));
+        if (!includeColumns.isEmpty())
+            indexSql += QLatin1String(" INCLUDE (") + includeColumns.join(QLatin1String(", ")) + QLatin1Char(')');
+
+        // partial indices are not supported by MySQL, which gets a full index
+        if (!index.where.isEmpty() &&
+            (databaseType == QDjangoDatabase::PostgreSQL ||
+             databaseType == QDjangoDatabase::SQLite ||
+             databaseType == QDjangoDatabase::MSSqlServer))
+            indexSql += QLatin1String(" WHERE ") + index.where;
+        queries << indexSql;
     }
 
     return queries;
@@ -691,9 +1068,9 @@ QObject *QDjangoMetaModel::foreignKey(const QObject *model, const char *name) co
     const QByteArray foreignClass = d->foreignFields[prop];
     const QDjangoMetaModel foreignMeta = QDjango::metaModel(foreignClass);
     const QVariant foreignPk = model->property(prop + "_id");
-    if (foreign->property(foreignMeta.primaryKey()) != foreignPk)
+    if (foreignMeta.fieldValue(foreign, "pk") != foreignPk)
     {
-        QDjangoQuerySetPrivate qs(foreignClass);
+        QDjangoQuerySetPrivate qs(foreignClass, foreignMeta);
         qs.addFilter(QDjangoWhere(QLatin1String("pk"), QDjangoWhere::Equals, foreignPk));
         qs.sqlFetch();
         if (qs.properties.size() != 1 || !qs.sqlLoad(foreign, 0))
@@ -726,7 +1103,7 @@ void QDjangoMetaModel::setForeignKey(QObject *model, const char *name, QObject *
     model->setProperty(prop + "_ptr", qVariantFromValue(value));
     if (value) {
         const QDjangoMetaModel foreignMeta = QDjango::metaModel(d->foreignFields[prop]);
-        model->setProperty(prop + "_id", value->property(foreignMeta.primaryKey()));
+        model->setProperty(prop + "_id", foreignMeta.fieldValue(value, "pk"));
     } else {
         model->setProperty(prop + "_id", QVariant());
     }
@@ -737,24 +1114,71 @@ void QDjangoMetaModel::setForeignKey(QObject *model, const char *name, QObject *
 */
 void QDjangoMetaModel::load(QObject *model, const QVariantList &properties, int &pos) const
 {
-    // process local fields
-    foreach (const QDjangoMetaField &field, d->localFields)
-        model->setProperty(field.d->name, properties.at(pos++));
+    // process local fields, writing through the model descriptor or the
+    // meta property unless the model is of another class or the property
+    // is dynamic
+    const bool indexed = (model->metaObject() == d->metaObject);
+    const bool typed = d->isTyped(model);
+    if (typed)
+        d->accessor.load(model, properties, pos, d->accessorColumns.constData());
+    for (int i = 0; i < d->localFields.size(); ++i, ++pos) {
+        if (typed && d->accessorFields.at(i) >= 0)
+            continue;
+        const QMetaProperty &property = d->fieldProperties.at(i);
+        if (indexed && property.isValid())
+            property.write(model, properties.at(pos));
+        else
+            model->setProperty(d->localFields.at(i).d->name, properties.at(pos));
+    }
 
     // process foreign fields
     if (pos >= properties.size())
         return;
-    foreach (const QByteArray &fkName, d->foreignFields.keys())
+    foreach (const QDjangoMetaForeignKey &foreignKey, d->foreignKeys)
     {
-        QObject *object = model->property(fkName + "_ptr").value<QObject*>();
+        QObject *object = model->property(foreignKey.ptrName).value<QObject*>();
         if (object)
         {
-            const QDjangoMetaModel foreignMeta = QDjango::metaModel(d->foreignFields[fkName]);
+            const QDjangoMetaModel foreignMeta = QDjango::metaModel(foreignKey.model);
             foreignMeta.load(object, properties, pos);
         }
     }
 }
 
+/*!
+    Loads the given properties into an \a object of a plain model, which
+    does not derive from QObject.
+
+    Only the fields listed by the model descriptor are written.
+*/
+void QDjangoMetaModel::load(void *object, const QVariantList &properties, int &pos) const
+{
+    if (d->accessor.load)
+        d->accessor.load(object, properties, pos, d->accessorColumns.constData());
+    pos += d->localFields.size();
+}
+
+/*!
+    Returns the value of the local field with the specified \a name
+    for the given \a model instance.
+*/
+QVariant QDjangoMetaModel::fieldValue(const QObject *model, const char *name) const
+{
+    const int index = d->fieldIndex(name);
+    return index >= 0 ? d->fieldValue(model, index) : QVariant();
+}
+
+/*!
+    Sets the \a value of the local field with the specified \a name
+    for the given \a model instance.
+*/
+void QDjangoMetaModel::setFieldValue(QObject *model, const char *name, const QVariant &value) const
+{
+    const int index = d->fieldIndex(name);
+    if (index >= 0)
+        d->setFieldValue(model, index, value);
+}
+
 /*!
     Returns the foreign field mapping.
 */
@@ -768,12 +1192,17 @@ QMap<QByteArray, QByteArray> QDjangoMetaModel::foreignFields() const
 */
 QDjangoMetaField QDjangoMetaModel::localField(const char *name) const
 {
-    const QByteArray fieldName = strcmp(name, "pk") ? QByteArray(name) : d->primaryKey;
-    foreach (const QDjangoMetaField &field, d->localFields) {
-        if (field.d->name == fieldName)
-            return field;
-    }
-    return QDjangoMetaField();
+    const int index = d->fieldIndex(name);
+    return index >= 0 ? d->localFields.at(index) : QDjangoMetaField();
+}
+
+/*!
+    Returns the position in localFields() of the local field with the
+    specified \a name, or -1 if there is no such field.
+*/
+int QDjangoMetaModel::localFieldIndex(const char *name) const
+{
+    return d->fieldIndex(name);
 }
 
 /*!
@@ -784,6 +1213,49 @@ QList<QDjangoMetaField> QDjangoMetaModel::localFields() const
     return d->localFields;
 }
 
+/*!
+    Returns the columns of each index declared by the model, whether it
+    comes from the primary key, a unique or db_index field option, or the
+    unique_together and index_together model options.
+
+    Only the key columns are listed, in the order in which they are indexed.
+*/
+QList<QStringList> QDjangoMetaModel::indexedColumns() const
+{
+    QList<QStringList> indexes;
+    foreach (const QDjangoMetaField &field, d->localFields) {
+        if (field.d->name == d->primaryKey || field.d->unique || field.d->index)
+            indexes << (QStringList() << field.column());
+    }
+
+    if (!d->uniqueTogether.isEmpty()) {
+        QStringList columns;
+        foreach (const QByteArray &name, d->uniqueTogether)
+            columns << localField(name).column();
+        indexes << columns;
+    }
+
+    foreach (const QDjangoMetaIndex &index, d->indexTogether) {
+        QStringList columns;
+        foreach (const QByteArray &name, index.fields)
+            columns << localField(name).column();
+        indexes << columns;
+    }
+    return indexes;
+}
+
+/*!
+    Returns the name given to an index on \a table over the given
+    \a columns, where descending columns are prefixed with '-'.
+
+    This is the name used by createTableSql(), so that an index created
+    by other means can be matched with the one a model would declare.
+*/
+QString QDjangoMetaModel::indexName(const QString &table, const QStringList &columns)
+{
+    return table + QLatin1Char('_') + stringlist_digest(columns);
+}
+
 /*!
     Returns the name of the primary key for the current QDjangoMetaModel.
 */
@@ -800,17 +1272,143 @@ QString QDjangoMetaModel::table() const
     return d->table;
 }
 
+/*!
+    Returns the column of the local field with the specified \a name,
+    escaped for the driver of \a db.
+
+    Escaped identifiers are computed once per driver and cached.
+*/
+QString QDjangoMetaModel::escapedColumn(const char *name, const QSqlDatabase &db) const
+{
+    const int index = d->fieldIndex(name);
+    if (index < 0)
+        return db.driver()->escapeIdentifier(QString(), QSqlDriver::FieldName);
+    return d->escapedIdentifiers(db).columns.at(index);
+}
+
+/*!
+    Returns the columns of the local fields, in the same order as
+    localFields(), escaped for the driver of \a db.
+*/
+QStringList QDjangoMetaModel::escapedColumns(const QSqlDatabase &db) const
+{
+    return d->escapedIdentifiers(db).columns;
+}
+
+/*!
+    Returns the name of the database table, escaped for the driver of \a db.
+*/
+QString QDjangoMetaModel::escapedTable(const QSqlDatabase &db) const
+{
+    return d->escapedIdentifiers(db).table;
+}
+
+/*!
+    Returns the escaped table and columns for the driver of \a db.
+
+    Once computed they never change, so callers which escape many names
+    can look them up once and keep a reference for as long as they hold
+    a copy of this QDjangoMetaModel.
+*/
+const QDjangoMetaModelIdentifiers &QDjangoMetaModel::escapedIdentifiers(const QSqlDatabase &db) const
+{
+    return d->escapedIdentifiers(db);
+}
+
 /*!
     Removes the given \a model instance from the database.
 */
 bool QDjangoMetaModel::remove(QObject *model) const
 {
-    const QVariant pk = model->property(d->primaryKey);
-    QDjangoQuerySetPrivate qs(model->metaObject()->className());
+    const QVariant pk = d->fieldValue(model, d->primaryKeyIndex);
+    QDjangoQuerySetPrivate qs(model->metaObject()->className(), *this);
     qs.addFilter(QDjangoWhere(QLatin1String("pk"), QDjangoWhere::Equals, pk));
     return qs.sqlDelete();
 }
 
+/*!
+    Inserts the given \a models into the database using a single batch
+    statement.
+
+    Unlike save(), this does not check whether the models already exist
+    and does not retrieve auto-incremented primary keys.
+
+    \return true if the insertion succeeded, false otherwise
+*/
+bool QDjangoMetaModel::bulkInsert(const QList<QObject*> &models) const
+{
+    // prepare data
+    QList<QVariantMap> rows;
+    rows.reserve(models.size());
+    foreach (const QObject *model, models)
+        rows << d->insertFields(d->fieldValues(model));
+
+    // perform INSERT
+    QDjangoQuerySetPrivate qs(d->className.toLatin1(), *this);
+    return qs.sqlBulkInsert(rows);
+}
+
+/*!
+    Inserts the given \a objects of a plain model, which does not derive
+    from QObject, into the database using a single batch statement.
+
+    \return true if the insertion succeeded, false otherwise
+*/
+bool QDjangoMetaModel::bulkInsert(const QList<void*> &objects) const
+{
+    if (!d->accessor.load)
+        return false;
+
+    // prepare data
+    QList<QVariantMap> rows;
+    rows.reserve(objects.size());
+    foreach (const void *object, objects)
+        rows << d->insertFields(d->typedFieldValues(object));
+
+    // perform INSERT
+    QDjangoQuerySetPrivate qs(d->className.toLatin1(), *this);
+    return qs.sqlBulkInsert(rows);
+}
+
+/*!
+    Removes the given \a models from the database using a single batch
+    statement.
+
+    \return true if deletion succeeded, false otherwise
+*/
+bool QDjangoMetaModel::bulkRemove(const QList<QObject*> &models) const
+{
+    QVariantList pks;
+    pks.reserve(models.size());
+    foreach (const QObject *model, models)
+        pks << d->fieldValue(model, d->primaryKeyIndex);
+
+    QDjangoQuerySetPrivate qs(d->className.toLatin1(), *this);
+    return qs.sqlBulkDelete(pks);
+}
+
+/*!
+    Removes the given \a objects of a plain model, which does not derive
+    from QObject, from the database using a single batch statement.
+
+    The primary key must be listed by the model descriptor.
+
+    \return true if deletion succeeded, false otherwise
+*/
+bool QDjangoMetaModel::bulkRemove(const QList<void*> &objects) const
+{
+    if (!d->accessor.load)
+        return false;
+
+    QVariantList pks;
+    pks.reserve(objects.size());
+    foreach (const void *object, objects)
+        pks << d->typedFieldValue(object, d->primaryKeyIndex);
+
+    QDjangoQuerySetPrivate qs(d->className.toLatin1(), *this);
+    return qs.sqlBulkDelete(pks);
+}
+
 /*!
     Saves the given \a model instance to the database.
 
@@ -820,50 +1418,47 @@ bool QDjangoMetaModel::save(QObject *model) const
 {
     // find primary key
     const QDjangoMetaField primaryKey = localField("pk");
-    const QVariant pk = model->property(d->primaryKey);
+    const QVariantList values = d->fieldValues(model);
+    const QVariant pk = values.at(d->primaryKeyIndex);
     if (!pk.isNull() && !(primaryKey.d->type == QVariant::Int && !pk.toInt()))
     {
         QSqlDatabase db = QDjango::database();
         QDjangoQuery query(db);
-        query.prepare(QString::fromLatin1("SELECT 1 AS a FROM %1 WHERE %2 = ?").arg(
-                      db.driver()->escapeIdentifier(d->table, QSqlDriver::FieldName),
-                      db.driver()->escapeIdentifier(primaryKey.column(), QSqlDriver::FieldName)));
+        const QDjangoMetaModelIdentifiers &escaped = d->escapedIdentifiers(db);
+        QDjangoSqlBuilder sql(64);
+        sql << QLatin1String("SELECT 1 AS a FROM ") << escaped.table
+            << QLatin1String(" WHERE ") << escaped.columns.at(d->fieldIndex("pk"))
+            << QLatin1String(" = ?");
+        query.prepare(sql.sql());
         query.addBindValue(pk);
         if (query.exec() && query.next())
         {
             // prepare data
             QVariantMap fields;
-            foreach (const QDjangoMetaField &field, d->localFields) {
-                if (field.d->name != d->primaryKey) {
-                    const QVariant value = model->property(field.d->name);
-                    fields.insert(QString::fromLatin1(field.d->name), field.toDatabase(value));
-                }
+            for (int i = 0; i < d->localFields.size(); ++i) {
+                const QDjangoMetaField &field = d->localFields.at(i);
+                if (i != d->primaryKeyIndex)
+                    fields.insert(QString::fromLatin1(field.d->name), field.toDatabase(values.at(i)));
             }
 
             // perform UPDATE
-            QDjangoQuerySetPrivate qs(model->metaObject()->className());
+            QDjangoQuerySetPrivate qs(model->metaObject()->className(), *this);
             qs.addFilter(QDjangoWhere(QLatin1String("pk"), QDjangoWhere::Equals, pk));
             return qs.sqlUpdate(fields) != -1;
         }
     }
 
     // prepare data
-    QVariantMap fields;
-    foreach (const QDjangoMetaField &field, d->localFields) {
-        if (!field.d->autoIncrement) {
-            const QVariant value = model->property(field.d->name);
-            fields.insert(field.name(), field.toDatabase(value));
-        }
-    }
+    const QVariantMap fields = d->insertFields(values);
 
     // perform INSERT
-    QDjangoQuerySetPrivate qs(model->metaObject()->className());
+    QDjangoQuerySetPrivate qs(model->metaObject()->className(), *this);
     if (primaryKey.d->autoIncrement) {
         // fetch autoincrement pk
         QVariant insertId;
         if (!qs.sqlInsert(fields, &insertId))
             return false;
-        model->setProperty(d->primaryKey, insertId);
+        d->setFieldValue(model, d->primaryKeyIndex, insertId);
     } else {
         if (!qs.sqlInsert(fields))
             return false;
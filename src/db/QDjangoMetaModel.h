@@ -18,6 +18,7 @@
 #ifndef QDJANGOMETAMODEL_H
 #define QDJANGOMETAMODEL_H
 
+#include <QList>
 #include <QMap>
 #include <QSharedDataPointer>
 #include <QVariant>
@@ -27,6 +28,59 @@
 class QDjangoMetaFieldPrivate;
 class QDjangoMetaModelPrivate;
 
+/** \brief The QDjangoModelAccessor class holds typed accessors for the
+ *  fields of a model, as generated from a QDjangoModelDescriptor.
+ *
+ * \internal
+ */
+class QDjangoModelAccessor
+{
+public:
+    /** \brief The Field class describes a field listed by a descriptor.
+     */
+    class Field
+    {
+    public:
+        Field()
+            : type(0)
+            , options(0)
+            , slot(-1)
+            , value(0)
+            , setValue(0)
+        {
+        }
+
+        QByteArray name;
+        int type;
+        const char *options;
+
+        /// Passed to value() and setValue() to find the field's descriptor.
+        int slot;
+        QVariant (*value)(const void *model, int slot);
+        void (*setValue)(void *model, int slot, const QVariant &value);
+    };
+
+    QDjangoModelAccessor()
+        : options(0)
+        , load(0)
+        , read(0)
+    {
+    }
+
+    QByteArray className;
+    const char *options;
+    QList<Field> fields;
+
+    // The model is passed as a QObject pointer for QObject models, and
+    // as a pointer to the plain model otherwise.
+
+    /// Writes \c values to the fields, where \c columns holds for each
+    /// field its offset from \c pos, or -1 to leave it untouched.
+    void (*load)(void *model, const QVariantList &values, int pos, const int *columns);
+    /// Appends the value of each field to \c values.
+    void (*read)(const void *model, QVariantList &values);
+};
+
 /** \brief The QDjangoMetaField class holds the database schema for a field.
  *
  * \internal
@@ -52,6 +106,19 @@ public:
 private:
     QSharedDataPointer<QDjangoMetaFieldPrivate> d;
     friend class QDjangoMetaModel;
+    friend class QDjangoMetaModelPrivate;
+};
+
+/** \brief The QDjangoMetaModelIdentifiers class holds the table and column
+ *  names of a model, escaped for a database driver.
+ *
+ * \internal
+ */
+class QDJANGO_EXPORT QDjangoMetaModelIdentifiers
+{
+public:
+    QString table;
+    QStringList columns;
 };
 
 /** \brief The QDjangoMetaModel class holds the database schema for a model.
@@ -64,7 +131,7 @@ private:
 class QDJANGO_EXPORT QDjangoMetaModel
 {
 public:
-    QDjangoMetaModel(const QMetaObject *model = 0);
+    QDjangoMetaModel(const QMetaObject *model = 0, const QDjangoModelAccessor &accessor = QDjangoModelAccessor());
     QDjangoMetaModel(const QDjangoMetaModel &other);
     ~QDjangoMetaModel();
     QDjangoMetaModel& operator=(const QDjangoMetaModel &other);
@@ -76,19 +143,36 @@ public:
     bool dropTable() const;
 
     void load(QObject *model, const QVariantList &props, int &pos) const;
+    void load(void *object, const QVariantList &props, int &pos) const;
     bool remove(QObject *model) const;
     bool save(QObject *model) const;
 
+    bool bulkInsert(const QList<QObject*> &models) const;
+    bool bulkInsert(const QList<void*> &objects) const;
+    bool bulkRemove(const QList<QObject*> &models) const;
+    bool bulkRemove(const QList<void*> &objects) const;
+
+    QVariant fieldValue(const QObject *model, const char *name) const;
+    void setFieldValue(QObject *model, const char *name, const QVariant &value) const;
+
     QObject *foreignKey(const QObject *model, const char *name) const;
     void setForeignKey(QObject *model, const char *name, QObject *value) const;
 
     QString className() const;
     QDjangoMetaField localField(const char *name) const;
+    int localFieldIndex(const char *name) const;
     QList<QDjangoMetaField> localFields() const;
     QMap<QByteArray, QByteArray> foreignFields() const;
+    QList<QStringList> indexedColumns() const;
+    static QString indexName(const QString &table, const QStringList &columns);
     QByteArray primaryKey() const;
     QString table() const;
 
+    QString escapedColumn(const char *name, const QSqlDatabase &db) const;
+    QStringList escapedColumns(const QSqlDatabase &db) const;
+    QString escapedTable(const QSqlDatabase &db) const;
+    const QDjangoMetaModelIdentifiers &escapedIdentifiers(const QSqlDatabase &db) const;
+
 private:
     QSharedDataPointer<QDjangoMetaModelPrivate> d;
 };
@@ -35,8 +35,8 @@ QDjangoModel::QDjangoModel(QObject *parent)
  */
 QVariant QDjangoModel::pk() const
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
-    return property(metaModel.primaryKey());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
+    return metaModel.fieldValue(this, "pk");
 }
 
 /** Sets the primary key for this QDjangoModel.
@@ -45,8 +45,8 @@ QVariant QDjangoModel::pk() const
  */
 void QDjangoModel::setPk(const QVariant &pk)
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
-    setProperty(metaModel.primaryKey(), pk);
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
+    metaModel.setFieldValue(this, "pk", pk);
 }
 
 /** Retrieves the QDjangoModel pointed to by the given foreign-key.
@@ -55,7 +55,7 @@ void QDjangoModel::setPk(const QVariant &pk)
  */
 QObject *QDjangoModel::foreignKey(const char *name) const
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
     return metaModel.foreignKey(this, name);
 }
 
@@ -68,7 +68,7 @@ QObject *QDjangoModel::foreignKey(const char *name) const
  */
 void QDjangoModel::setForeignKey(const char *name, QObject *value)
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
     metaModel.setForeignKey(this, name, value);
 }
 
@@ -78,7 +78,7 @@ void QDjangoModel::setForeignKey(const char *name, QObject *value)
  */
 bool QDjangoModel::remove()
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
     return metaModel.remove(this);
 }
 
@@ -88,7 +88,7 @@ bool QDjangoModel::remove()
  */
 bool QDjangoModel::save()
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
     return metaModel.save(this);
 }
 
@@ -96,8 +96,8 @@ bool QDjangoModel::save()
  */
 QString QDjangoModel::toString() const
 {
-    const QDjangoMetaModel metaModel = QDjango::metaModel(metaObject()->className());
+    const QDjangoMetaModel metaModel = QDjango::metaModel(this);
     const QByteArray pkName = metaModel.primaryKey();
-    return QString::fromLatin1("%1(%2=%3)").arg(QString::fromLatin1(metaObject()->className()), QString::fromLatin1(pkName), property(pkName).toString());
+    return QString::fromLatin1("%1(%2=%3)").arg(QString::fromLatin1(metaObject()->className()), QString::fromLatin1(pkName), metaModel.fieldValue(this, "pk").toString());
 }
 
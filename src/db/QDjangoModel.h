@@ -44,6 +44,13 @@
  *  \li \c unique_together set of fields that, taken together, must be unique.
  *  If provided, a UNIQUE statement is included in the CREATE TABLE statement.
  *  Example: \c unique_together=some_field,other_field
+ *  \li \c index_together groups of fields on which an index is created,
+ *  separated by semicolons. A field prefixed with '-' is indexed in
+ *  descending order. A group can be followed by '+' and the fields covered
+ *  by the index (INCLUDE on PostgreSQL), then by '?' and the predicate of
+ *  a partial index (PostgreSQL and SQLite). Values containing spaces must
+ *  be double quoted.
+ *  Example: \c index_together="last_name,-date_joined+email?is_active = 1;username,email"
  *
  *  You can also provide additional information about a field using the
  *  Q_CLASSINFO macro, in the form:
@@ -57,6 +64,8 @@
  *  \li \c auto_increment if set to 'true', and if this field is the primary
  *  key, it will be marked as auto-increment.
  *  \li \c blank if set to 'true', this field is allowed to be empty.
+ *  \li \c case_insensitive if set to 'true', an index on the lower-cased
+ *  field is created on PostgreSQL, which serves the \c IEquals lookups.
  *  \li \c db_column if provided, this is the name of the database column for
  *  the field, otherwise the field name will be used
  *  \li \c db_index if set to 'true', an index will be created on this field.
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "QDjangoModelArena.h"
+
+/** Constructs a new arena which allocates memory in blocks of
+ *  \a blockSize bytes.
+ */
+QDjangoModelArena::QDjangoModelArena(int blockSize)
+    : m_current(0)
+    , m_remaining(0)
+    , m_blockSize(blockSize)
+{
+}
+
+/** Destroys the arena along with all the objects it holds.
+ */
+QDjangoModelArena::~QDjangoModelArena()
+{
+    clear();
+}
+
+/// \cond
+
+void *QDjangoModelArena::allocate(int size, int alignment, void (*destroy)(void*))
+{
+    // align the current position
+    const int padding = int((alignment - quintptr(m_current) % alignment) % alignment);
+    if (!m_current || padding + size > m_remaining) {
+        // objects larger than a block get a block of their own
+        const int blockSize = qMax(m_blockSize, size + alignment);
+        char *block = new char[blockSize];
+        m_blocks << block;
+        m_current = block;
+        m_remaining = blockSize;
+        return allocate(size, alignment, destroy);
+    }
+
+    void *memory = m_current + padding;
+    m_current += padding + size;
+    m_remaining -= padding + size;
+
+    // the pointer is set once the object is constructed
+    Object object;
+    object.pointer = 0;
+    object.destroy = destroy;
+    m_objects.append(object);
+    return memory;
+}
+
+/// \endcond
+
+/** Destroys all the objects in the arena and releases its memory.
+ */
+void QDjangoModelArena::clear()
+{
+    for (int i = m_objects.size() - 1; i >= 0; --i) {
+        const Object &object = m_objects.at(i);
+        if (object.pointer)
+            object.destroy(object.pointer);
+    }
+    m_objects.clear();
+
+    foreach (char *block, m_blocks)
+        delete [] block;
+    m_blocks.clear();
+    m_current = 0;
+    m_remaining = 0;
+}
+
+/** Returns the number of objects in the arena.
+ */
+int QDjangoModelArena::size() const
+{
+    return m_objects.size();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_MODEL_ARENA_H
+#define QDJANGO_MODEL_ARENA_H
+
+#include <new>
+
+#include <QList>
+#include <QVector>
+
+#include "QDjango_p.h"
+
+/** \brief The QDjangoModelArena class allocates model instances from
+ *  large memory blocks which are released all at once.
+ *
+ *  Loading a set of models with QDjangoQuerySet::at() performs one heap
+ *  allocation per object, which you later free one by one. When the
+ *  objects share the same lifetime, for instance while handling a request,
+ *  you can instead load them into an arena using QDjangoQuerySet::fetch().
+ *  The objects are then packed into a few blocks and are destroyed, in
+ *  reverse order of creation, when the arena is cleared or destroyed:
+ *
+ * \code
+ * QDjangoModelArena arena;
+ * QList<User*> users;
+ * QDjangoQuerySet<User>().fetch(arena, &users);
+ * // use the users, do not delete them
+ * \endcode
+ *
+ *  Objects created in an arena must not be deleted, nor given a parent.
+ *  Memory allocated by the objects themselves, such as the private data
+ *  of a QObject, is still allocated on the heap.
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoModelArena
+{
+public:
+    QDjangoModelArena(int blockSize = 16384);
+    ~QDjangoModelArena();
+
+    template <class T>
+    T *create();
+
+    void clear();
+    int size() const;
+
+private:
+    Q_DISABLE_COPY(QDjangoModelArena)
+    void *allocate(int size, int alignment, void (*destroy)(void*));
+
+    template <class T>
+    static void destroy(void *object)
+    {
+        static_cast<T*>(object)->~T();
+    }
+
+    class Object
+    {
+    public:
+        void *pointer;
+        void (*destroy)(void*);
+    };
+
+    QList<char*> m_blocks;
+    QVector<Object> m_objects;
+    char *m_current;
+    int m_remaining;
+    int m_blockSize;
+};
+
+/** Constructs a new object of class T in the arena.
+ *
+ *  The object will be destroyed when the arena is cleared or destroyed.
+ */
+template <class T>
+T *QDjangoModelArena::create()
+{
+    void *memory = allocate(int(sizeof(T)), int(Q_ALIGNOF(T)), &destroy<T>);
+    T *object = new (memory) T;
+    m_objects.last().pointer = object;
+    return object;
+}
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_MODEL_DESCRIPTOR_H
+#define QDJANGO_MODEL_DESCRIPTOR_H
+
+#include <QVariant>
+
+#include "QDjangoMetaModel.h"
+
+/// \cond
+
+template <class V>
+struct QDjangoValueType
+{
+    typedef V Type;
+};
+
+template <class V>
+struct QDjangoValueType<const V>
+{
+    typedef V Type;
+};
+
+template <class V>
+struct QDjangoValueType<const V&>
+{
+    typedef V Type;
+};
+
+/// \endcond
+
+/** \brief The QDjangoFieldDescriptor class describes a model field
+ *  through its getter and setter.
+ *
+ *  You do not usually construct it directly, use qdjangoField() instead.
+ *
+ * \ingroup Database
+ */
+template <class T, class V, class A>
+class QDjangoFieldDescriptor
+{
+public:
+    typedef typename QDjangoValueType<V>::Type Value;
+    typedef V (T::*Getter)() const;
+    typedef void (T::*Setter)(A);
+
+    QDjangoFieldDescriptor(const char *name, Getter getter, Setter setter, const char *options)
+        : name(name)
+        , options(options)
+        , getter(getter)
+        , setter(setter)
+    {
+    }
+
+    Value get(const T *model) const { return (model->*getter)(); }
+    void set(T *model, const Value &value) const { (model->*setter)(value); }
+
+    const char *name;
+    const char *options;
+
+private:
+    Getter getter;
+    Setter setter;
+};
+
+/** \brief The QDjangoMemberDescriptor class describes a model field
+ *  stored in a data member.
+ *
+ *  You do not usually construct it directly, use qdjangoField() instead.
+ *
+ * \ingroup Database
+ */
+template <class T, class V>
+class QDjangoMemberDescriptor
+{
+public:
+    typedef V Value;
+    typedef V T::*Member;
+
+    QDjangoMemberDescriptor(const char *name, Member member, const char *options)
+        : name(name)
+        , options(options)
+        , member(member)
+    {
+    }
+
+    const Value &get(const T *model) const { return model->*member; }
+    void set(T *model, const Value &value) const { model->*member = value; }
+
+    const char *name;
+    const char *options;
+
+private:
+    Member member;
+};
+
+/** Returns a descriptor for the field \a name of model class T, which is
+ *  read using \a getter and written using \a setter.
+ *
+ *  The \a options are the same as those accepted by Q_CLASSINFO for a
+ *  property, for instance "max_length=255 unique=true".
+ */
+template <class T, class V, class A>
+QDjangoFieldDescriptor<T, V, A> qdjangoField(const char *name, V (T::*getter)() const, void (T::*setter)(A), const char *options = 0)
+{
+    return QDjangoFieldDescriptor<T, V, A>(name, getter, setter, options);
+}
+
+/** Returns a descriptor for the field \a name of model class T, which is
+ *  stored in the data \a member.
+ *
+ *  The \a options are the same as those accepted by Q_CLASSINFO for a
+ *  property, for instance "max_length=255 unique=true".
+ */
+template <class T, class V>
+QDjangoMemberDescriptor<T, V> qdjangoField(const char *name, V T::*member, const char *options = 0)
+{
+    return QDjangoMemberDescriptor<T, V>(name, member, options);
+}
+
+/** \brief The QDjangoModelDescriptor class lists the fields of a model
+ *  at compile time.
+ *
+ *  By default the fields of a model are found by inspecting its
+ *  properties at runtime. A model can instead specialize this template,
+ *  in which case QDjango::registerModel() builds the schema from the
+ *  descriptor and rows are loaded and saved by calling the getters and
+ *  setters directly, bypassing the QVariant based property system:
+ *
+ * \code
+ * template <>
+ * class QDjangoModelDescriptor<Book>
+ * {
+ * public:
+ *     enum { IsDefined = 1 };
+ *
+ *     template <class Visitor>
+ *     static void visit(Visitor &visitor)
+ *     {
+ *         visitor(qdjangoField("title", &Book::title, &Book::setTitle, "max_length=255"));
+ *         visitor(qdjangoField("pages", &Book::pages, &Book::setPages));
+ *     }
+ * };
+ * \endcode
+ *
+ *  Foreign keys are not supported in descriptors.
+ *
+ * \sa QDjangoModelTraits
+ *
+ * \ingroup Database
+ */
+template <class T>
+class QDjangoModelDescriptor
+{
+public:
+    enum { IsDefined = 0 };
+
+    template <class Visitor>
+    static void visit(Visitor &)
+    {
+    }
+};
+
+/** \brief The QDjangoModelTraits class tells QDjango how to identify a
+ *  model class.
+ *
+ *  By default a model is a QObject subclass with the Q_OBJECT macro and
+ *  is identified by its meta object.
+ *
+ *  Plain structs which do not derive from QObject can also be used as
+ *  models, which avoids the cost of a QObject per row. Such a model must
+ *  specialize QDjangoModelDescriptor to list its fields and this template,
+ *  usually by deriving from QDjangoPlainModelTraits, to give its name:
+ *
+ * \code
+ * struct Point
+ * {
+ *     int id;
+ *     double x;
+ *     double y;
+ * };
+ *
+ * template <>
+ * class QDjangoModelTraits<Point> : public QDjangoPlainModelTraits
+ * {
+ * public:
+ *     static const char *className() { return "Point"; }
+ * };
+ *
+ * template <>
+ * class QDjangoModelDescriptor<Point>
+ * {
+ * public:
+ *     enum { IsDefined = 1 };
+ *
+ *     template <class Visitor>
+ *     static void visit(Visitor &visitor)
+ *     {
+ *         visitor(qdjangoField("id", &Point::id, "primary_key=true auto_increment=true"));
+ *         visitor(qdjangoField("x", &Point::x));
+ *         visitor(qdjangoField("y", &Point::y));
+ *     }
+ * };
+ * \endcode
+ *
+ *  Plain models can be loaded and written through QDjangoQuerySet, for
+ *  instance with QDjangoQuerySet::load() to fill a std::vector<Point>,
+ *  QDjangoQuerySet::bulkInsert() or QDjangoQuerySet::update().
+ *
+ * \ingroup Database
+ */
+template <class T>
+class QDjangoModelTraits
+{
+public:
+    enum { IsObject = 1 };
+
+    static const QMetaObject *metaObject() { return &T::staticMetaObject; }
+    static const char *className() { return T::staticMetaObject.className(); }
+    static const char *options() { return 0; }
+};
+
+/** \brief The QDjangoPlainModelTraits class is a convenience base class
+ *  for the QDjangoModelTraits of a model which does not derive from QObject.
+ *
+ *  The table options which would otherwise be given by the "__meta__"
+ *  class info can be returned by options().
+ *
+ * \ingroup Database
+ */
+class QDjangoPlainModelTraits
+{
+public:
+    enum { IsObject = 0 };
+
+    static const QMetaObject *metaObject() { return 0; }
+    static const char *options() { return 0; }
+};
+
+/// \cond
+
+template <class T, bool IsObject = QDjangoModelTraits<T>::IsObject>
+class QDjangoModelCast
+{
+public:
+    typedef QObject *Pointer;
+
+    static T *cast(void *model) { return static_cast<T*>(static_cast<QObject*>(model)); }
+    static const T *cast(const void *model) { return static_cast<const T*>(static_cast<const QObject*>(model)); }
+};
+
+template <class T>
+class QDjangoModelCast<T, false>
+{
+public:
+    typedef void *Pointer;
+
+    static T *cast(void *model) { return static_cast<T*>(model); }
+    static const T *cast(const void *model) { return static_cast<const T*>(model); }
+};
+
+// holds the descriptors of type Descriptor listed for model class T, so
+// that a field can be reached directly from its slot
+template <class T, class Descriptor>
+class QDjangoDescriptorStorage
+{
+public:
+    typedef typename Descriptor::Value Value;
+
+    static QList<Descriptor> &descriptors()
+    {
+        static QList<Descriptor> list;
+        return list;
+    }
+
+    static QVariant value(const void *model, int slot)
+    {
+        return QVariant::fromValue<Value>(descriptors().at(slot).get(QDjangoModelCast<T>::cast(model)));
+    }
+
+    static void setValue(void *model, int slot, const QVariant &value)
+    {
+        descriptors().at(slot).set(QDjangoModelCast<T>::cast(model), qvariant_cast<Value>(value));
+    }
+};
+
+template <class T>
+class QDjangoDescriptorFields
+{
+public:
+    template <class Descriptor>
+    void operator()(const Descriptor &descriptor)
+    {
+        typedef QDjangoDescriptorStorage<T, Descriptor> Storage;
+        Storage::descriptors().append(descriptor);
+
+        QDjangoModelAccessor::Field field;
+        field.name = descriptor.name;
+        field.type = qMetaTypeId<typename Descriptor::Value>();
+        field.options = descriptor.options;
+        field.slot = Storage::descriptors().size() - 1;
+        field.value = &Storage::value;
+        field.setValue = &Storage::setValue;
+        fields << field;
+    }
+
+    QList<QDjangoModelAccessor::Field> fields;
+};
+
+template <class T>
+class QDjangoDescriptorLoader
+{
+public:
+    QDjangoDescriptorLoader(T *model, const QVariantList &values, int pos, const int *columns)
+        : model(model), values(values), pos(pos), columns(columns), field(0)
+    {
+    }
+
+    template <class Descriptor>
+    void operator()(const Descriptor &descriptor)
+    {
+        const int column = columns[field++];
+        if (column >= 0)
+            descriptor.set(model, qvariant_cast<typename Descriptor::Value>(values.at(pos + column)));
+    }
+
+private:
+    T *model;
+    const QVariantList &values;
+    int pos;
+    const int *columns;
+    int field;
+};
+
+template <class T>
+class QDjangoDescriptorReader
+{
+public:
+    QDjangoDescriptorReader(const T *model, QVariantList &values)
+        : model(model), values(values)
+    {
+    }
+
+    template <class Descriptor>
+    void operator()(const Descriptor &descriptor)
+    {
+        values << QVariant::fromValue<typename Descriptor::Value>(descriptor.get(model));
+    }
+
+private:
+    const T *model;
+    QVariantList &values;
+};
+
+template <class T>
+class QDjangoModelAccessors
+{
+public:
+    static void load(void *model, const QVariantList &values, int pos, const int *columns)
+    {
+        QDjangoDescriptorLoader<T> loader(QDjangoModelCast<T>::cast(model), values, pos, columns);
+        QDjangoModelDescriptor<T>::visit(loader);
+    }
+
+    static void read(const void *model, QVariantList &values)
+    {
+        QDjangoDescriptorReader<T> reader(QDjangoModelCast<T>::cast(model), values);
+        QDjangoModelDescriptor<T>::visit(reader);
+    }
+
+    // the descriptors are only stored once, however often the model
+    // is registered
+    static QDjangoModelAccessor accessor()
+    {
+        static const QDjangoModelAccessor instance = create();
+        return instance;
+    }
+
+private:
+    static QDjangoModelAccessor create()
+    {
+        QDjangoDescriptorFields<T> fields;
+        QDjangoModelDescriptor<T>::visit(fields);
+
+        QDjangoModelAccessor accessor;
+        accessor.className = QDjangoModelTraits<T>::className();
+        accessor.options = QDjangoModelTraits<T>::options();
+        accessor.fields = fields.fields;
+        accessor.load = &load;
+        accessor.read = &read;
+        return accessor;
+    }
+};
+
+/// \endcond
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <QThread>
+
+#include "QDjango.h"
+#include "QDjangoQueryBudget.h"
+
+/// \cond
+
+class QDjangoQueryBudgetPrivate
+{
+public:
+    QMap<QString, int> counts;
+    int maxQueries;
+    int maxRepeats;
+    int queryCount;
+    QThread *thread;
+};
+
+/// \endcond
+
+/*!
+    Constructs a new query budget which warns when a statement is repeated
+    more than \a maxRepeats times, or when more than \a maxQueries
+    statements are executed. A negative value disables the corresponding
+    limit.
+
+    Counting starts immediately.
+*/
+QDjangoQueryBudget::QDjangoQueryBudget(int maxRepeats, int maxQueries)
+    : d(new QDjangoQueryBudgetPrivate)
+{
+    d->maxQueries = maxQueries;
+    d->maxRepeats = maxRepeats;
+    d->queryCount = 0;
+    d->thread = QThread::currentThread();
+    QDjango::addQueryObserver(this);
+}
+
+/*!
+    Stops counting and destroys the query budget.
+*/
+QDjangoQueryBudget::~QDjangoQueryBudget()
+{
+    QDjango::removeQueryObserver(this);
+    delete d;
+}
+
+/*!
+    Returns the number of statements executed for each fingerprint.
+*/
+QMap<QString, int> QDjangoQueryBudget::counts() const
+{
+    return d->counts;
+}
+
+/*!
+    Returns true if a statement was repeated more than maxRepeats() times,
+    or if more than maxQueries() statements were executed.
+*/
+bool QDjangoQueryBudget::isExceeded() const
+{
+    if (d->maxQueries >= 0 && d->queryCount > d->maxQueries)
+        return true;
+    return !repeatedQueries().isEmpty();
+}
+
+/*!
+    Returns the total number of statements executed.
+*/
+int QDjangoQueryBudget::queryCount() const
+{
+    return d->queryCount;
+}
+
+/*!
+    Returns the fingerprints of the statements which were repeated more
+    than maxRepeats() times.
+*/
+QStringList QDjangoQueryBudget::repeatedQueries() const
+{
+    QStringList fingerprints;
+    if (d->maxRepeats < 0)
+        return fingerprints;
+
+    QMap<QString, int>::const_iterator it;
+    for (it = d->counts.constBegin(); it != d->counts.constEnd(); ++it) {
+        if (it.value() > d->maxRepeats)
+            fingerprints << it.key();
+    }
+    return fingerprints;
+}
+
+/*!
+    Returns the maximum number of statements which can be executed.
+*/
+int QDjangoQueryBudget::maxQueries() const
+{
+    return d->maxQueries;
+}
+
+/*!
+    Sets the maximum number of statements which can be executed.
+
+    \param maxQueries
+*/
+void QDjangoQueryBudget::setMaxQueries(int maxQueries)
+{
+    d->maxQueries = maxQueries;
+}
+
+/*!
+    Returns the maximum number of times a statement can be repeated.
+*/
+int QDjangoQueryBudget::maxRepeats() const
+{
+    return d->maxRepeats;
+}
+
+/*!
+    Sets the maximum number of times a statement can be repeated.
+
+    \param maxRepeats
+*/
+void QDjangoQueryBudget::setMaxRepeats(int maxRepeats)
+{
+    d->maxRepeats = maxRepeats;
+}
+
+/*!
+    Counts the statement described by \a event, and warns once each time
+    a limit is crossed.
+*/
+void QDjangoQueryBudget::queryExecuted(const QDjangoQueryEvent &event)
+{
+    if (QThread::currentThread() != d->thread)
+        return;
+
+    const int count = ++d->counts[event.fingerprint];
+    if (d->maxRepeats >= 0 && count == d->maxRepeats + 1)
+        qWarning("Query repeated more than %d times, possible N+1 pattern: %s",
+                 d->maxRepeats, qPrintable(event.fingerprint));
+
+    d->queryCount++;
+    if (d->maxQueries >= 0 && d->queryCount == d->maxQueries + 1)
+        qWarning("Query budget of %d statements exceeded", d->maxQueries);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_QUERY_BUDGET_H
+#define QDJANGO_QUERY_BUDGET_H
+
+#include <QMap>
+#include <QStringList>
+
+#include "QDjangoQueryObserver.h"
+
+class QDjangoQueryBudgetPrivate;
+
+/** \brief The QDjangoQueryBudget class counts the SQL statements executed
+ *  within a scope, in order to detect N+1 query patterns.
+ *
+ *  Statements are grouped by fingerprint, so that the lazy loading of a
+ *  foreign key inside a loop shows up as one fingerprint repeated once
+ *  per iteration. A warning is printed when a fingerprint is repeated
+ *  more than maxRepeats() times, or when more than maxQueries() statements
+ *  are executed in total.
+ *
+ *  The budget installs itself as a query observer for its lifetime, and
+ *  only counts statements executed by the thread which created it, so it
+ *  can wrap the handling of a single HTTP request:
+ *
+ *  \code
+ *  QDjangoHttpResponse *MyController::serveItems(const QDjangoHttpRequest &request)
+ *  {
+ *      QDjangoQueryBudget budget(5);
+ *      ...
+ *  }
+ *  \endcode
+ *
+ *  In unit tests, isExceeded() allows the test to fail:
+ *
+ *  \code
+ *  QDjangoQueryBudget budget(1, 3);
+ *  renderItems();
+ *  QVERIFY2(!budget.isExceeded(), qPrintable(budget.repeatedQueries().join("\n")));
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoQueryBudget : public QDjangoQueryObserver
+{
+public:
+    QDjangoQueryBudget(int maxRepeats = 10, int maxQueries = -1);
+    ~QDjangoQueryBudget();
+
+    QMap<QString, int> counts() const;
+    bool isExceeded() const;
+    int queryCount() const;
+    QStringList repeatedQueries() const;
+
+    int maxQueries() const;
+    void setMaxQueries(int maxQueries);
+
+    int maxRepeats() const;
+    void setMaxRepeats(int maxRepeats);
+
+    void queryExecuted(const QDjangoQueryEvent &event);
+
+private:
+    Q_DISABLE_COPY(QDjangoQueryBudget)
+    QDjangoQueryBudgetPrivate* const d;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_QUERY_OBSERVER_H
+#define QDJANGO_QUERY_OBSERVER_H
+
+#include <QString>
+#include <QVariant>
+
+#include "QDjango_p.h"
+
+/** \brief The QDjangoQueryEvent class describes an SQL statement which
+ *  was executed by QDjango.
+ *
+ *  All durations are expressed in nanoseconds.
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoQueryEvent
+{
+public:
+    QDjangoQueryEvent();
+
+    static QString fingerprint(const QString &sql);
+
+    /** The SQL of the statement, with placeholders for bound values. */
+    QString sql;
+
+    /** The SQL with literals and lists of placeholders collapsed, so that
+     *  statements which only differ by their values share a fingerprint. */
+    QString fingerprint;
+
+    /** The name of the connection which executed the statement. */
+    QString connectionName;
+
+    /** The values bound to the statement, in order. */
+    QVariantList boundValues;
+
+    /** The number of rows fetched with next(), or -1 if the statement is
+     *  not a SELECT. Rows reached with first(), last() or seek() are not
+     *  counted; QDjango itself only uses next(). */
+    int rowsReturned;
+
+    /** The number of rows affected, or -1 if it is not known. */
+    int rowsAffected;
+
+    /** The time spent preparing the statement, or 0 if it was not
+     *  prepared since its previous execution. */
+    qint64 prepareTime;
+
+    /** The time spent executing the statement. */
+    qint64 executionTime;
+
+    /** The time spent fetching the rows of a SELECT with next(). */
+    qint64 fetchTime;
+
+    /** Whether the statement executed successfully. */
+    bool success;
+
+    /** The error reported by the database if the statement failed. */
+    QString error;
+};
+
+/** \brief The QDjangoQueryObserver class is the interface for receiving
+ *  a QDjangoQueryEvent for each SQL statement executed by QDjango.
+ *
+ *  Observers are installed with QDjango::addQueryObserver(). When no
+ *  observer is installed, statements are not timed at all.
+ *
+ *  queryExecuted() is called in the thread which executed the statement,
+ *  once all its rows have been fetched, or when the query is discarded or
+ *  executed again.
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoQueryObserver
+{
+public:
+    virtual ~QDjangoQueryObserver();
+
+    /** Called when a statement has completed.
+     *
+     * \param event
+     */
+    virtual void queryExecuted(const QDjangoQueryEvent &event) = 0;
+};
+
+#endif
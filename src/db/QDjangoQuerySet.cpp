@@ -16,7 +16,12 @@
  * Lesser General Public License for more details.
  */
 
+#include <climits>
+
+#include <QDataStream>
 #include <QDebug>
+#include <QReadWriteLock>
+#include <QRegExp>
 #include <QSqlDriver>
 #include <QSqlRecord>
 
@@ -28,36 +33,104 @@
 /// \cond
 
 QDjangoCompiler::QDjangoCompiler(const char *modelName, const QSqlDatabase &db)
+    : database(db)
+    , driver(db.driver())
+    , aliasPrefix(QLatin1String("T"))
+    , subQueryCount(0)
+    , baseModel(QDjango::metaModel(modelName))
+    , identifiers(baseModel.escapedIdentifiers(db))
+{
+}
+
+QDjangoCompiler::QDjangoCompiler(const QDjangoMetaModel &model, const QSqlDatabase &db)
+    : database(db)
+    , driver(db.driver())
+    , aliasPrefix(QLatin1String("T"))
+    , subQueryCount(0)
+    , baseModel(model)
+    , identifiers(baseModel.escapedIdentifiers(db))
 {
-    driver = db.driver();
-    baseModel = QDjango::metaModel(modelName);
 }
 
 QString QDjangoCompiler::referenceModel(const QString &modelPath, QDjangoMetaModel *metaModel, bool nullable)
 {
     if (modelPath.isEmpty())
-        return driver->escapeIdentifier(baseModel.table(), QSqlDriver::TableName);
+        return identifiers.table;
 
     if (modelRefs.contains(modelPath))
         return modelRefs.value(modelPath).tableReference;
 
-    const QString modelRef = QLatin1String("T") + QString::number(modelRefs.size());
+    const QString modelRef = aliasPrefix + QString::number(modelRefs.size());
     modelRefs.insert(modelPath, QDjangoModelReference(modelRef, *metaModel, nullable));
     return modelRef;
 }
 
 QString QDjangoCompiler::databaseColumn(const QString &name)
 {
+    QMap<QString, QString>::const_iterator it = fieldColumnCache.constFind(name);
+    if (it != fieldColumnCache.constEnd())
+        return it.value();
+
+    QDjangoColumnPath path;
+    if (!resolveColumnPath(name, &path))
+        return QString();
+
+    // register the joins required by the lookup
+    QString modelRef = referenceModel(QString(), &baseModel, false);
+    foreach (const QDjangoColumnPathStep &step, path.steps) {
+        if (step.reverse)
+            reverseModelRefs[step.modelPath] = step.reverseReference;
+        QDjangoMetaModel metaModel = step.metaModel;
+        modelRef = referenceModel(step.modelPath, &metaModel, step.nullable);
+    }
+
+    const QString column = modelRef + QLatin1Char('.') + path.column;
+    fieldColumnCache.insert(name, column);
+    return column;
+}
+
+// resolved lookups, shared by all compilers
+static QReadWriteLock globalColumnPathLock;
+static QHash<QString, QDjangoColumnPath> globalColumnPaths;
+
+void QDjangoCompiler::clearColumnPaths()
+{
+    QWriteLocker locker(&globalColumnPathLock);
+    globalColumnPaths.clear();
+}
+
+bool QDjangoCompiler::resolveColumnPath(const QString &name, QDjangoColumnPath *path) const
+{
+    const QString cacheKey = baseModel.className() + QLatin1Char(':') + database.driverName()
+        + QLatin1Char(':') + name;
+    {
+        QReadLocker locker(&globalColumnPathLock);
+        QHash<QString, QDjangoColumnPath>::const_iterator it = globalColumnPaths.constFind(cacheKey);
+        if (it != globalColumnPaths.constEnd()) {
+            *path = it.value();
+            return true;
+        }
+    }
+
     QDjangoMetaModel model = baseModel;
-    QString modelName;
     QString modelPath;
-    QString modelRef = referenceModel(QString(), &model, false);
     QStringList bits = name.split(QLatin1String("__"));
 
     while (bits.size() > 1) {
         const QByteArray fk = bits.first().toLatin1();
-        QDjangoMetaModel foreignModel;
-        bool foreignNullable = false;
+        QDjangoColumnPathStep step;
+
+        // a lookup on the primary key of a foreign model is resolved to
+        // the local foreign key column, which avoids a join
+        if (bits.size() == 2 && model.foreignFields().contains(fk)) {
+            const QDjangoMetaModel targetModel = QDjango::metaModel(model.foreignFields()[fk]);
+            const QDjangoMetaField targetKey = targetModel.localField("pk");
+            const QString targetName = bits.last();
+            if (targetName == QLatin1String("pk") || targetName == targetKey.name() || targetName == targetKey.column()) {
+                path->column = model.escapedColumn(fk + QByteArray("_id"), database);
+                break;
+            }
+        }
 
         if (!modelPath.isEmpty())
             modelPath += QLatin1String("__");
@@ -66,37 +139,39 @@ QString QDjangoCompiler::databaseColumn(const QString &name)
         if (!model.foreignFields().contains(fk)) {
             // this might be a reverse relation, so look for the model
             // and if it exists continue
-            foreignModel = QDjango::metaModel(fk);
-            QDjangoReverseReference rev;
-            const QMap<QByteArray, QByteArray> foreignFields = foreignModel.foreignFields();
+            step.metaModel = QDjango::metaModel(fk);
+            const QMap<QByteArray, QByteArray> foreignFields = step.metaModel.foreignFields();
             foreach (const QByteArray &foreignKey, foreignFields.keys()) {
                 if (foreignFields[foreignKey] == baseModel.className()) {
-                    rev.leftHandKey = foreignModel.localField(foreignKey + "_id").column();
+                    step.reverseReference.leftHandKey = step.metaModel.localField(foreignKey + "_id").column();
                     break;
                 }
             }
 
-            if (rev.leftHandKey.isEmpty()) {
+            if (step.reverseReference.leftHandKey.isEmpty()) {
                 qWarning() << "Invalid field lookup" << name;
-                return QString();
+                return false;
             }
-            rev.rightHandKey = foreignModel.primaryKey();
-            reverseModelRefs[modelPath] = rev;
+            step.reverseReference.rightHandKey = step.metaModel.primaryKey();
+            step.reverse = true;
         } else {
-            foreignModel = QDjango::metaModel(model.foreignFields()[fk]);
-            foreignNullable = model.localField(fk + QByteArray("_id")).isNullable();;
+            step.metaModel = QDjango::metaModel(model.foreignFields()[fk]);
+            step.nullable = model.localField(fk + QByteArray("_id")).isNullable();
         }
 
-        // store reference
-        modelRef = referenceModel(modelPath, &foreignModel, foreignNullable);
-        modelName = fk;
+        step.modelPath = modelPath;
+        path->steps << step;
 
-        model = foreignModel;
+        model = step.metaModel;
         bits.takeFirst();
     }
 
-    const QDjangoMetaField field = model.localField(bits.join(QLatin1String("__")).toLatin1());
-    return modelRef + QLatin1Char('.') + driver->escapeIdentifier(field.column(), QSqlDriver::FieldName);
+    if (path->column.isEmpty())
+        path->column = model.escapedColumn(bits.join(QLatin1String("__")).toLatin1(), database);
+
+    QWriteLocker locker(&globalColumnPathLock);
+    globalColumnPaths.insert(cacheKey, *path);
+    return true;
 }
 
 QStringList QDjangoCompiler::fieldNames(bool recurse, QDjangoMetaModel *metaModel, const QString &modelPath, bool nullable)
@@ -107,8 +182,11 @@ QStringList QDjangoCompiler::fieldNames(bool recurse, QDjangoMetaModel *metaMode
 
     // store reference
     const QString tableName = referenceModel(modelPath, metaModel, nullable);
-    foreach (const QDjangoMetaField &field, metaModel->localFields())
-        columns << tableName + QLatin1Char('.') + driver->escapeIdentifier(field.column(), QSqlDriver::FieldName);
+    const QStringList &escapedColumns = (metaModel == &baseModel)
+        ? identifiers.columns : metaModel->escapedIdentifiers(database).columns;
+    columns.reserve(escapedColumns.size());
+    foreach (const QString &column, escapedColumns)
+        columns << tableName + QLatin1Char('.') + column;
     if (!recurse)
         return columns;
 
@@ -122,86 +200,107 @@ QStringList QDjangoCompiler::fieldNames(bool recurse, QDjangoMetaModel *metaMode
     return columns;
 }
 
-QString QDjangoCompiler::fromSql()
+/** Returns the database columns for the given field \a names, which may
+ *  follow relations such as "user__username".
+ */
+QStringList QDjangoCompiler::fieldColumns(const QStringList &names)
+{
+    QStringList columns;
+    columns.reserve(names.size());
+    foreach (const QString &name, names)
+        columns << databaseColumn(name);
+    return columns;
+}
+
+void QDjangoCompiler::appendFrom(QDjangoSqlBuilder &sql)
 {
-    QString from = driver->escapeIdentifier(baseModel.table(), QSqlDriver::TableName);
+    sql << identifiers.table;
     foreach (const QString &name, modelRefs.keys()) {
         const QDjangoModelReference &ref = modelRefs[name];
+        const QDjangoMetaModelIdentifiers &escaped = ref.metaModel.escapedIdentifiers(database);
 
         QString leftHandColumn, rightHandColumn;
         if (reverseModelRefs.contains(name)) {
             const QDjangoReverseReference &rev = reverseModelRefs[name];
-            leftHandColumn = ref.tableReference + "." + driver->escapeIdentifier(rev.leftHandKey, QSqlDriver::FieldName);;
+            leftHandColumn = ref.tableReference + QLatin1Char('.') + driver->escapeIdentifier(rev.leftHandKey, QSqlDriver::FieldName);
             rightHandColumn = databaseColumn(rev.rightHandKey);
         } else {
-            leftHandColumn = databaseColumn(name + QLatin1String("__pk"));
+            leftHandColumn = ref.tableReference + QLatin1Char('.') + escaped.columns.at(ref.metaModel.localFieldIndex("pk"));
             rightHandColumn = databaseColumn(name + QLatin1String("_id"));
         }
-        from += QString::fromLatin1(" %1 %2 %3 ON %4 = %5")
-            .arg(ref.nullable ? "LEFT OUTER JOIN" : "INNER JOIN")
-            .arg(driver->escapeIdentifier(ref.metaModel.table(), QSqlDriver::TableName))
-            .arg(ref.tableReference)
-            .arg(leftHandColumn)
-            .arg(rightHandColumn);
+        sql << QLatin1String(ref.nullable ? " LEFT OUTER JOIN " : " INNER JOIN ")
+            << escaped.table << QLatin1Char(' ') << ref.tableReference
+            << QLatin1String(" ON ") << leftHandColumn << QLatin1String(" = ") << rightHandColumn;
     }
-    return from;
 }
 
-QString QDjangoCompiler::orderLimitSql(const QStringList &orderBy, int lowMark, int highMark)
+void QDjangoCompiler::appendOrderLimit(QDjangoSqlBuilder &sql, const QStringList &orderBy, int lowMark, int highMark)
 {
-    QString limit;
-
     // order
-    QStringList bits;
-    QString field;
-    foreach (field, orderBy) {
-        QString order = QLatin1String("ASC");
-        if (field.startsWith(QLatin1Char('-'))) {
-            order = QLatin1String("DESC");
-            field = field.mid(1);
-        } else if (field.startsWith(QLatin1Char('+'))) {
-            field = field.mid(1);
-        }
-        bits.append(databaseColumn(field) + QLatin1Char(' ') + order);
+    bool hasOrder = false;
+    foreach (const QString &field, orderBy) {
+        sql << QLatin1String(hasOrder ? ", " : " ORDER BY ");
+        hasOrder = true;
+        if (field.startsWith(QLatin1Char('-')))
+            sql << databaseColumn(field.mid(1)) << QLatin1String(" DESC");
+        else if (field.startsWith(QLatin1Char('+')))
+            sql << databaseColumn(field.mid(1)) << QLatin1String(" ASC");
+        else
+            sql << databaseColumn(field) << QLatin1String(" ASC");
     }
 
-    if (!bits.isEmpty())
-        limit += QLatin1String(" ORDER BY ") + bits.join(QLatin1String(", "));
-
     // limits
     QDjangoDatabase::DatabaseType databaseType =
         QDjangoDatabase::databaseType(QDjango::database());
 
     if (databaseType == QDjangoDatabase::MSSqlServer) {
-        if (limit.isEmpty() && (highMark > 0 || lowMark > 0))
-            limit += QLatin1String(" ORDER BY ") + databaseColumn(baseModel.primaryKey());
+        if (!hasOrder && (highMark > 0 || lowMark > 0))
+            sql << QLatin1String(" ORDER BY ") << databaseColumn(baseModel.primaryKey());
 
-        if (lowMark > 0 || (lowMark == 0 && highMark > 0)) {
-            limit += QLatin1String(" OFFSET ") + QString::number(lowMark);
-            limit += QLatin1String(" ROWS");
-        }
+        if (lowMark > 0 || (lowMark == 0 && highMark > 0))
+            sql << QLatin1String(" OFFSET ") << lowMark << QLatin1String(" ROWS");
 
         if (highMark > 0)
-            limit += QString(" FETCH NEXT %1 ROWS ONLY").arg(highMark - lowMark);
+            sql << QLatin1String(" FETCH NEXT ") << (highMark - lowMark) << QLatin1String(" ROWS ONLY");
     } else {
         if (highMark > 0)
-            limit += QLatin1String(" LIMIT ") + QString::number(highMark - lowMark);
+            sql << QLatin1String(" LIMIT ") << (highMark - lowMark);
 
         if (lowMark > 0) {
             // no-limit is backend specific
             if (highMark <= 0) {
                 if (databaseType == QDjangoDatabase::SQLite)
-                    limit += QLatin1String(" LIMIT -1");
+                    sql << QLatin1String(" LIMIT -1");
                 else if (databaseType == QDjangoDatabase::MySqlServer)
                     // 2^64 - 1, as recommended by the MySQL documentation
-                    limit += QLatin1String(" LIMIT 18446744073709551615");
+                    sql << QLatin1String(" LIMIT 18446744073709551615");
             }
 
-            limit += QLatin1String(" OFFSET ") + QString::number(lowMark);
+            sql << QLatin1String(" OFFSET ") << lowMark;
         }
     }
+}
+
+void QDjangoCompiler::appendWhere(QDjangoSqlBuilder &sql, const QDjangoWhere &where)
+{
+    if (!where.isAll()) {
+        sql << QLatin1String(" WHERE ");
+        QDjangoWherePrivate::appendSql(where, sql, database, QDjangoDatabase::databaseType(database));
+    }
+}
 
-    return limit;
+QString QDjangoCompiler::fromSql()
+{
+    QDjangoSqlBuilder sql;
+    appendFrom(sql);
+    return sql.sql();
+}
+
+QString QDjangoCompiler::orderLimitSql(const QStringList &orderBy, int lowMark, int highMark)
+{
+    QDjangoSqlBuilder sql(64);
+    appendOrderLimit(sql, orderBy, lowMark, highMark);
+    return sql.sql();
 }
 
 void QDjangoCompiler::resolve(QDjangoWhere &where)
@@ -210,19 +309,52 @@ void QDjangoCompiler::resolve(QDjangoWhere &where)
     if (where.d->operation != QDjangoWhere::None)
         where.d->key = databaseColumn(where.d->key);
 
+    // compile subquery using a nested compiler with its own table aliases
+    if (where.d->subQuery) {
+        const QDjangoSubQuery &source = *where.d->subQuery;
+        QSharedPointer<QDjangoSubQuery> subQuery(new QDjangoSubQuery(source));
+
+        QDjangoCompiler compiler(source.modelName, database);
+        compiler.aliasPrefix = aliasPrefix.left(aliasPrefix.size() - 1)
+            + QLatin1Char('S') + QString::number(subQueryCount++) + QLatin1String("_T");
+        compiler.resolve(subQuery->where);
+
+        // order and limit columns may add joins, so resolve them first
+        const QString column = compiler.databaseColumn(QLatin1String("pk"));
+        const QString limit = (source.lowMark || source.highMark) ?
+            compiler.orderLimitSql(source.orderBy, source.lowMark, source.highMark) : QString();
+        QDjangoSqlBuilder sql;
+        sql << QLatin1String("SELECT ") << column << QLatin1String(" FROM ");
+        compiler.appendFrom(sql);
+        compiler.appendWhere(sql, subQuery->where);
+        sql << limit;
+        subQuery->sql = sql.sql();
+        where.d->subQuery = subQuery;
+    }
+
     // recurse into children
     for (int i = 0; i < where.d->children.size(); i++)
         resolve(where.d->children[i]);
 }
 
-QDjangoQuerySetPrivate::QDjangoQuerySetPrivate(const char *modelName)
+QDjangoQuerySetPrivate::QDjangoQuerySetPrivate(const char *modelName, const QDjangoMetaModel &metaModel)
     : counter(1),
     hasResults(false),
     lowMark(0),
     highMark(0),
     selectRelated(false),
-    m_modelName(modelName)
+    total(-1),
+    m_modelName(modelName),
+    m_metaModel(metaModel.isValid() ? metaModel : QDjango::metaModel(modelName))
+{
+}
+
+/** Returns the meta model of the queryset, which is resolved when the
+ *  queryset is created unless the model was not registered yet.
+ */
+QDjangoMetaModel QDjangoQuerySetPrivate::metaModel() const
 {
+    return m_metaModel.isValid() ? m_metaModel : QDjango::metaModel(m_modelName);
 }
 
 void QDjangoQuerySetPrivate::addFilter(const QDjangoWhere &where)
@@ -230,17 +362,56 @@ void QDjangoQuerySetPrivate::addFilter(const QDjangoWhere &where)
     // it is not possible to add filters once a limit has been set
     Q_ASSERT(!lowMark && !highMark);
 
-    whereClause = whereClause && where;
+    // simplify once here rather than every time the query is compiled
+    whereClause = (whereClause && where).simplified();
 }
 
 QDjangoWhere QDjangoQuerySetPrivate::resolvedWhere(const QSqlDatabase &db) const
 {
-    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoCompiler compiler(metaModel(), db);
     QDjangoWhere resolvedWhere(whereClause);
     compiler.resolve(resolvedWhere);
     return resolvedWhere;
 }
 
+bool QDjangoQuerySetPrivate::sqlBulkDelete(const QVariantList &pks)
+{
+    if (pks.isEmpty())
+        return true;
+
+    // execute query
+    QDjangoQuery query(bulkDeleteQuery(pks));
+    if (!query.execBatch())
+        return false;
+
+    // invalidate cache
+    if (hasResults) {
+        properties.clear();
+        hasResults = false;
+    }
+    total = -1;
+    return true;
+}
+
+bool QDjangoQuerySetPrivate::sqlBulkInsert(const QList<QVariantMap> &rows)
+{
+    if (rows.isEmpty())
+        return true;
+
+    // execute query
+    QDjangoQuery query(bulkInsertQuery(rows));
+    if (!query.execBatch())
+        return false;
+
+    // invalidate cache
+    if (hasResults) {
+        properties.clear();
+        hasResults = false;
+    }
+    total = -1;
+    return true;
+}
+
 bool QDjangoQuerySetPrivate::sqlDelete()
 {
     // DELETE on an empty queryset doesn't need a query
@@ -263,9 +434,156 @@ bool QDjangoQuerySetPrivate::sqlDelete()
         properties.clear();
         hasResults = false;
     }
+    total = -1;
     return true;
 }
 
+/** Counts the rows in the current set, ignoring the limits unless
+ *  \a limited is true, or returns -1 if the query failed.
+ *
+ *  The result is looked up in and stored into the QDjangoCountCache.
+ */
+int QDjangoQuerySetPrivate::sqlCount(bool limited)
+{
+    QString key;
+    int count;
+    if (QDjangoCountCache::isEnabled()) {
+        key = countCacheKey(limited);
+        if (QDjangoCountCache::find(key, &count))
+            return count;
+    }
+
+    QDjangoQuery query(countQuery(limited));
+    if (!query.exec() || !query.next())
+        return -1;
+    count = query.value(0).toInt();
+    if (!key.isEmpty())
+        QDjangoCountCache::insert(key, count);
+    return count;
+}
+
+/** Returns an estimate of the number of rows in the current set taken
+ *  from the statistics kept by the database, or -1 if none is available.
+ *
+ *  Unfiltered sets use the table statistics, filtered sets are only
+ *  estimated on PostgreSQL using the planner's row estimate.
+ */
+int QDjangoQuerySetPrivate::sqlEstimatedCount()
+{
+    // limits are not taken into account by the statistics
+    if (lowMark || highMark)
+        return -1;
+
+    QSqlDatabase db = QDjango::database();
+    const QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    QDjangoQuery query(db);
+
+    if (!whereClause.isAll()) {
+        if (databaseType != QDjangoDatabase::PostgreSQL)
+            return -1;
+
+        // the first line of the plan holds the estimate for the whole query,
+        // the values are inlined as EXPLAIN cannot be prepared
+        QVariantList values;
+        const QString sql = QDjangoDatabase::inlineValues(db, selectSql(&values), values);
+        if (!query.exec(QLatin1String("EXPLAIN ") + sql) || !query.next())
+            return -1;
+
+        QRegExp rowsRx(QLatin1String("rows=(\\d+)"));
+        if (rowsRx.indexIn(query.value(0).toString()) < 0)
+            return -1;
+        return int(qMin(rowsRx.cap(1).toLongLong(), qint64(INT_MAX)));
+    }
+
+    const QString table = metaModel().table();
+    switch (databaseType) {
+    case QDjangoDatabase::PostgreSQL:
+        query.prepare(QLatin1String("SELECT reltuples FROM pg_class WHERE oid = CAST(? AS regclass)"));
+        query.addBindValue(db.driver()->escapeIdentifier(table, QSqlDriver::TableName));
+        break;
+    case QDjangoDatabase::SQLite:
+        // sqlite_stat1 only exists once ANALYZE has been run
+        query.prepare(QLatin1String("SELECT idx, stat FROM sqlite_stat1 WHERE tbl = ?"));
+        query.addBindValue(table);
+        break;
+    case QDjangoDatabase::MySqlServer:
+        query.prepare(QLatin1String("SELECT TABLE_ROWS FROM information_schema.TABLES WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ?"));
+        query.addBindValue(table);
+        break;
+    default:
+        return -1;
+    }
+    if (!query.exec())
+        return -1;
+
+    // the first number of an sqlite_stat1 entry is the number of rows in
+    // the table if idx is NULL, otherwise in the index which may be partial,
+    // pg_class.reltuples is a float and is negative if never analyzed
+    qint64 estimate = -1;
+    if (databaseType == QDjangoDatabase::SQLite) {
+        while (query.next()) {
+            const qint64 rows = query.value(1).toString().section(QLatin1Char(' '), 0, 0).toLongLong();
+            if (query.value(0).isNull()) {
+                estimate = rows;
+                break;
+            }
+            estimate = qMax(estimate, rows);
+        }
+    } else {
+        if (!query.next() || query.value(0).isNull())
+            return -1;
+        estimate = qint64(query.value(0).toDouble());
+    }
+    if (estimate < 0)
+        return -1;
+    return int(qMin(estimate, qint64(INT_MAX)));
+}
+
+/** Returns the number of rows in the current set ignoring its limits, or
+ *  -1 if the query failed.
+ *
+ *  If the set is sliced and the database supports window functions, the
+ *  rows of the slice are fetched by the same statement.
+ */
+int QDjangoQuerySetPrivate::sqlTotalCount()
+{
+    if (whereClause.isNone())
+        return 0;
+    if (!lowMark && !highMark)
+        return hasResults ? properties.size() : sqlCount(false);
+    if (total >= 0)
+        return total;
+
+    if (!hasResults && QDjangoDatabase::hasWindowSupport(QDjango::database())) {
+        QDjangoQuery query(selectQuery(true));
+        if (!query.exec())
+            return -1;
+
+        // the total is the last column of each row
+        while (query.next()) {
+            QVariantList props;
+            const int propCount = query.record().count() - 1;
+            for (int i = 0; i < propCount; ++i)
+                props << query.value(i);
+            properties.append(props);
+            total = query.value(propCount).toInt();
+        }
+        hasResults = true;
+
+        // an empty slice does not tell us the total
+        if (total >= 0) {
+            if (QDjangoCountCache::isEnabled())
+                QDjangoCountCache::insert(countCacheKey(false), total);
+            return total;
+        }
+    }
+
+    const int count = sqlCount(false);
+    if (count >= 0)
+        total = count;
+    return count;
+}
+
 bool QDjangoQuerySetPrivate::sqlFetch()
 {
     if (hasResults || whereClause.isNone())
@@ -301,7 +619,7 @@ bool QDjangoQuerySetPrivate::sqlInsert(const QVariantMap &fields, QVariant *inse
         QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
 
         if (databaseType == QDjangoDatabase::PostgreSQL) {
-            const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+            const QDjangoMetaModel metaModel = this->metaModel();
             QDjangoQuery query(db);
             const QDjangoMetaField primaryKey = metaModel.localField("pk");
             const QString seqName = db.driver()->escapeIdentifier(metaModel.table() + QLatin1Char('_') + primaryKey.column() + QLatin1String("_seq"), QSqlDriver::FieldName);
@@ -318,11 +636,12 @@ bool QDjangoQuerySetPrivate::sqlInsert(const QVariantMap &fields, QVariant *inse
         properties.clear();
         hasResults = false;
     }
+    total = -1;
 
     return true;
 }
 
-bool QDjangoQuerySetPrivate::sqlLoad(QObject *model, int index)
+bool QDjangoQuerySetPrivate::fetchRow(int index)
 {
     if (!sqlFetch())
         return false;
@@ -332,32 +651,178 @@ bool QDjangoQuerySetPrivate::sqlLoad(QObject *model, int index)
         qWarning("QDjangoQuerySet out of bounds");
         return false;
     }
+    return true;
+}
 
-    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+bool QDjangoQuerySetPrivate::sqlLoad(QObject *model, int index)
+{
+    if (!fetchRow(index))
+        return false;
+
+    const QDjangoMetaModel metaModel = this->metaModel();
     int pos = 0;
     metaModel.load(model, properties.at(index), pos);
     return true;
 }
 
-/** Returns the SQL query to perform a COUNT on the current set.
+/** Loads the row at \a index into an \a object of a plain model, which
+ *  does not derive from QObject.
+ */
+bool QDjangoQuerySetPrivate::sqlLoad(void *object, int index)
+{
+    if (!fetchRow(index))
+        return false;
+
+    const QDjangoMetaModel metaModel = this->metaModel();
+    int pos = 0;
+    metaModel.load(object, properties.at(index), pos);
+    return true;
+}
+
+/** Splits the current set into at most \a count disjoint ranges of primary
+ *  key values, using the MIN and MAX of the primary key.
+ *
+ *  If the set cannot be split, for instance because the primary key is not
+ *  an integer, a single range with null bounds is returned. If the set is
+ *  empty, no range is returned.
+ */
+bool QDjangoQuerySetPrivate::sqlPkRanges(int count, QList<QPair<QVariant, QVariant> > *ranges)
+{
+    ranges->clear();
+    if (whereClause.isNone())
+        return true;
+
+    // an in-memory SQLite database cannot be shared between connections
+    QSqlDatabase db = QDjango::database();
+    if (count <= 1 || lowMark || highMark ||
+        (QDjangoDatabase::databaseType(db) == QDjangoDatabase::SQLite &&
+         db.databaseName() == QLatin1String(":memory:"))) {
+        ranges->append(qMakePair(QVariant(), QVariant()));
+        return true;
+    }
+
+    // execute query
+    QDjangoQuery query(pkRangeQuery());
+    if (!query.exec() || !query.next())
+        return false;
+
+    const QVariant minValue = query.value(0);
+    const QVariant maxValue = query.value(1);
+    if (minValue.isNull() || maxValue.isNull())
+        return true;
+
+    const QVariant::Type type = minValue.type();
+    if (type != QVariant::Int && type != QVariant::UInt &&
+        type != QVariant::LongLong && type != QVariant::ULongLong) {
+        ranges->append(qMakePair(QVariant(), QVariant()));
+        return true;
+    }
+
+    const qint64 low = minValue.toLongLong();
+    const qint64 high = maxValue.toLongLong();
+    const qint64 step = (high - low) / count + 1;
+    for (qint64 start = low; start <= high; start += step) {
+        const qint64 end = qMin(start + step - 1, high);
+        ranges->append(qMakePair(QVariant(start), QVariant(end)));
+    }
+    return true;
+}
+
+/** Returns the SQL query to perform a batch DELETE of the rows with the
+ *  specified primary keys.
+ */
+QDjangoQuery QDjangoQuerySetPrivate::bulkDeleteQuery(const QVariantList &pks) const
+{
+    QSqlDatabase db = QDjango::database();
+    const QDjangoMetaModel metaModel = this->metaModel();
+
+    const QDjangoMetaModelIdentifiers &escaped = metaModel.escapedIdentifiers(db);
+    QDjangoSqlBuilder sql(64);
+    sql << QLatin1String("DELETE FROM ") << escaped.table
+        << QLatin1String(" WHERE ") << escaped.columns.at(metaModel.localFieldIndex("pk")) << QLatin1String(" = ?");
+
+    QDjangoQuery query(db);
+    query.prepare(sql.sql());
+    query.addBindValues(pks);
+    return query;
+}
+
+/** Returns the SQL query to perform a batch INSERT of the specified \a rows.
+ *
+ *  All the rows must have the same fields. The values are bound column-wise
+ *  so the statement is only prepared once.
  */
-QDjangoQuery QDjangoQuerySetPrivate::countQuery() const
+QDjangoQuery QDjangoQuerySetPrivate::bulkInsertQuery(const QList<QVariantMap> &rows) const
+{
+    QSqlDatabase db = QDjango::database();
+    const QStringList names = rows.isEmpty() ? QStringList() : rows.first().keys();
+
+    QDjangoQuery query(db);
+    query.prepare(insertSql(db, names));
+    foreach (const QString &name, names) {
+        QVariantList values;
+        values.reserve(rows.size());
+        foreach (const QVariantMap &row, rows)
+            values << row.value(name);
+        query.addBindValues(values);
+    }
+    return query;
+}
+
+/** Returns the key under which the COUNT of the current set is cached:
+ *  the connection, the SQL and the bound values.
+ *
+ *  The statement is not prepared, so building the key does not involve
+ *  the database.
+ */
+QString QDjangoQuerySetPrivate::countCacheKey(bool limited) const
+{
+    QSqlDatabase db = QDjango::database();
+
+    QDjangoCompiler compiler(metaModel(), db);
+    QDjangoWhere resolvedWhere(whereClause);
+    compiler.resolve(resolvedWhere);
+
+    QDjangoSqlBuilder sql;
+    sql << db.connectionName() << QLatin1Char('\n');
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    if (limited)
+        sql << compiler.orderLimitSql(QStringList(), lowMark, highMark);
+
+    // the values are serialized as toString() loses the milliseconds of
+    // datetimes and is empty for some types
+    QDjangoQuery query(db);
+    resolvedWhere.bindValues(query);
+    QByteArray values;
+    QDataStream stream(&values, QIODevice::WriteOnly);
+    const int bindCount = query.boundValues().size();
+    for (int i = 0; i < bindCount; ++i)
+        stream << query.boundValue(i);
+    sql << QLatin1Char('\n') << QString::fromLatin1(values.toBase64());
+    return sql.sql();
+}
+
+/** Returns the SQL query to perform a COUNT on the current set, ignoring
+ *  the limits unless \a limited is true.
+ */
+QDjangoQuery QDjangoQuerySetPrivate::countQuery(bool limited) const
 {
     QSqlDatabase db = QDjango::database();
 
     // build query
-    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoCompiler compiler(metaModel(), db);
     QDjangoWhere resolvedWhere(whereClause);
     compiler.resolve(resolvedWhere);
 
-    const QString where = resolvedWhere.sql(db);
-    const QString limit = compiler.orderLimitSql(QStringList(), lowMark, highMark);
-    QString sql = QLatin1String("SELECT COUNT(*) FROM ") + compiler.fromSql();
-    if (!where.isEmpty())
-        sql += QLatin1String(" WHERE ") + where;
-    sql += limit;
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("SELECT COUNT(*) FROM ");
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    if (limited)
+        sql << compiler.orderLimitSql(QStringList(), lowMark, highMark);
     QDjangoQuery query(db);
-    query.prepare(sql);
+    query.prepare(sql.sql());
     resolvedWhere.bindValues(query);
 
     return query;
@@ -370,70 +835,133 @@ QDjangoQuery QDjangoQuerySetPrivate::deleteQuery() const
     QSqlDatabase db = QDjango::database();
 
     // build query
-    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoCompiler compiler(metaModel(), db);
     QDjangoWhere resolvedWhere(whereClause);
     compiler.resolve(resolvedWhere);
 
-    const QString where = resolvedWhere.sql(db);
     const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
-    QString sql = QLatin1String("DELETE FROM ") + compiler.fromSql();
-    if (!where.isEmpty())
-        sql += QLatin1String(" WHERE ") + where;
-    sql += limit;
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("DELETE FROM ");
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    sql << limit;
     QDjangoQuery query(db);
-    query.prepare(sql);
+    query.prepare(sql.sql());
     resolvedWhere.bindValues(query);
 
     return query;
 }
 
+/** Returns the SQL statement to perform an INSERT for the fields with the
+ *  specified \a names.
+ */
+QString QDjangoQuerySetPrivate::insertSql(const QSqlDatabase &db, const QStringList &names) const
+{
+    const QDjangoMetaModel metaModel = this->metaModel();
+
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("INSERT INTO ") << metaModel.escapedTable(db) << QLatin1String(" (");
+    for (int i = 0; i < names.size(); ++i) {
+        if (i)
+            sql << QLatin1String(", ");
+        sql << metaModel.escapedColumn(names.at(i).toLatin1(), db);
+    }
+    sql << QLatin1String(") VALUES(");
+    for (int i = 0; i < names.size(); ++i)
+        sql << QLatin1String(i ? ", ?" : "?");
+    sql << QLatin1Char(')');
+    return sql.sql();
+}
+
 /** Returns the SQL query to perform an INSERT for the specified \a fields.
  */
 QDjangoQuery QDjangoQuerySetPrivate::insertQuery(const QVariantMap &fields) const
 {
     QSqlDatabase db = QDjango::database();
-    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
 
     // perform INSERT
-    QStringList fieldColumns;
-    QStringList fieldHolders;
-    foreach (const QString &name, fields.keys()) {
-        const QDjangoMetaField field = metaModel.localField(name.toLatin1());
-        fieldColumns << db.driver()->escapeIdentifier(field.column(), QSqlDriver::FieldName);
-        fieldHolders << QLatin1String("?");
-    }
-
     QDjangoQuery query(db);
-    query.prepare(QString::fromLatin1("INSERT INTO %1 (%2) VALUES(%3)").arg(
-                  db.driver()->escapeIdentifier(metaModel.table(), QSqlDriver::TableName),
-                  fieldColumns.join(QLatin1String(", ")), fieldHolders.join(QLatin1String(", "))));
+    query.prepare(insertSql(db, fields.keys()));
     foreach (const QString &name, fields.keys())
         query.addBindValue(fields.value(name));
     return query;
 }
 
+/** Returns the SQL query to retrieve the lowest and highest primary key
+ *  values of the current set.
+ */
+QDjangoQuery QDjangoQuerySetPrivate::pkRangeQuery() const
+{
+    QSqlDatabase db = QDjango::database();
+    const QDjangoMetaModel metaModel = this->metaModel();
+
+    // build query
+    QDjangoCompiler compiler(metaModel, db);
+    QDjangoWhere resolvedWhere(whereClause);
+    compiler.resolve(resolvedWhere);
+
+    const QDjangoMetaModelIdentifiers &escaped = metaModel.escapedIdentifiers(db);
+    const QString primaryKey = escaped.table + QLatin1Char('.') + escaped.columns.at(metaModel.localFieldIndex("pk"));
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("SELECT MIN(") << primaryKey << QLatin1String("), MAX(") << primaryKey
+        << QLatin1String(") FROM ");
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    QDjangoQuery query(db);
+    query.prepare(sql.sql());
+    resolvedWhere.bindValues(query);
+    return query;
+}
+
 /** Returns the SQL query to perform a SELECT on the current set.
+ *
+ *  If \a withTotal is true, an extra column holds the number of rows
+ *  matching the WHERE clause regardless of the limits.
  */
-QDjangoQuery QDjangoQuerySetPrivate::selectQuery() const
+QDjangoQuery QDjangoQuerySetPrivate::selectQuery(bool withTotal) const
+{
+    QVariantList values;
+    QDjangoQuery query(QDjango::database());
+    query.prepare(selectSql(&values, withTotal));
+    foreach (const QVariant &value, values)
+        query.addBindValue(value);
+    return query;
+}
+
+/** Returns the SQL for a SELECT on the current set and stores the values
+ *  to bind in \a values, without preparing a statement.
+ *
+ *  If \a withTotal is true, an extra column holds the number of rows
+ *  matching the WHERE clause regardless of the limits.
+ */
+QString QDjangoQuerySetPrivate::selectSql(QVariantList *values, bool withTotal) const
 {
     QSqlDatabase db = QDjango::database();
 
     // build query
-    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoCompiler compiler(metaModel(), db);
     QDjangoWhere resolvedWhere(whereClause);
     compiler.resolve(resolvedWhere);
 
     const QStringList columns = compiler.fieldNames(selectRelated);
-    const QString where = resolvedWhere.sql(db);
     const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
-    QString sql = QLatin1String("SELECT ") + columns.join(QLatin1String(", ")) + QLatin1String(" FROM ") + compiler.fromSql();
-    if (!where.isEmpty())
-        sql += QLatin1String(" WHERE ") + where;
-    sql += limit;
+    QDjangoSqlBuilder sql(512);
+    sql << QLatin1String("SELECT ");
+    sql.appendJoined(columns, QLatin1String(", "));
+    if (withTotal)
+        sql << QLatin1String(", COUNT(*) OVER ()");
+    sql << QLatin1String(" FROM ");
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    sql << limit;
+
+    // an unprepared query collects the values as they would be bound
     QDjangoQuery query(db);
-    query.prepare(sql);
     resolvedWhere.bindValues(query);
-    return query;
+    const int bindCount = query.boundValues().size();
+    for (int i = 0; i < bindCount; ++i)
+        *values << query.boundValue(i);
+    return sql.sql();
 }
 
 /** Returns the SQL query to perform an UPDATE on the current set for the
@@ -442,30 +970,29 @@ QDjangoQuery QDjangoQuerySetPrivate::selectQuery() const
 QDjangoQuery QDjangoQuerySetPrivate::updateQuery(const QVariantMap &fields) const
 {
     QSqlDatabase db = QDjango::database();
-    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+    const QDjangoMetaModel metaModel = this->metaModel();
 
     // build query
-    QDjangoCompiler compiler(m_modelName, db);
+    QDjangoCompiler compiler(metaModel, db);
     QDjangoWhere resolvedWhere(whereClause);
     compiler.resolve(resolvedWhere);
 
-    QString sql = QLatin1String("UPDATE ") + compiler.fromSql();
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("UPDATE ");
+    compiler.appendFrom(sql);
 
     // add SET
-    QStringList fieldAssign;
+    bool first = true;
     foreach (const QString &name, fields.keys()) {
-        const QDjangoMetaField field = metaModel.localField(name.toLatin1());
-        fieldAssign << db.driver()->escapeIdentifier(field.column(), QSqlDriver::FieldName) + QLatin1String(" = ?");
+        sql << QLatin1String(first ? " SET " : ", ") << metaModel.escapedColumn(name.toLatin1(), db) << QLatin1String(" = ?");
+        first = false;
     }
-    sql += QLatin1String(" SET ") + fieldAssign.join(QLatin1String(", "));
 
     // add WHERE
-    const QString where = resolvedWhere.sql(db);
-    if (!where.isEmpty())
-        sql += QLatin1String(" WHERE ") + where;
+    compiler.appendWhere(sql, resolvedWhere);
 
     QDjangoQuery query(db);
-    query.prepare(sql);
+    query.prepare(sql.sql());
     foreach (const QString &name, fields.keys())
         query.addBindValue(fields.value(name));
     resolvedWhere.bindValues(query);
@@ -473,6 +1000,36 @@ QDjangoQuery QDjangoQuerySetPrivate::updateQuery(const QVariantMap &fields) cons
     return query;
 }
 
+/** Returns the SQL query to SELECT only the given \a fields of the current
+    set, or all the local fields if \a fields is empty.
+ */
+QDjangoQuery QDjangoQuerySetPrivate::valuesQuery(const QStringList &fields) const
+{
+    QSqlDatabase db = QDjango::database();
+
+    // build query
+    QDjangoCompiler compiler(metaModel(), db);
+    QDjangoWhere resolvedWhere(whereClause);
+    compiler.resolve(resolvedWhere);
+
+    const QStringList columns = fields.isEmpty() ? compiler.fieldNames(false) : compiler.fieldColumns(fields);
+    const QString limit = compiler.orderLimitSql(orderBy, lowMark, highMark);
+    QDjangoSqlBuilder sql;
+    sql << QLatin1String("SELECT ");
+    sql.appendJoined(columns, QLatin1String(", "));
+    sql << QLatin1String(" FROM ");
+    compiler.appendFrom(sql);
+    compiler.appendWhere(sql, resolvedWhere);
+    sql << limit;
+
+    // rows are read once, in order
+    QDjangoQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare(sql.sql());
+    resolvedWhere.bindValues(query);
+    return query;
+}
+
 int QDjangoQuerySetPrivate::sqlUpdate(const QVariantMap &fields)
 {
     // UPDATE on an empty queryset doesn't need a query
@@ -495,6 +1052,7 @@ int QDjangoQuerySetPrivate::sqlUpdate(const QVariantMap &fields)
         properties.clear();
         hasResults = false;
     }
+    total = -1;
 
     return query.numRowsAffected();
 }
@@ -505,7 +1063,7 @@ QList<QVariantMap> QDjangoQuerySetPrivate::sqlValues(const QStringList &fields)
     if (!sqlFetch())
         return values;
 
-    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+    const QDjangoMetaModel metaModel = this->metaModel();
 
     // build field list
     const QList<QDjangoMetaField> localFields = metaModel.localFields();
@@ -515,13 +1073,8 @@ QList<QVariantMap> QDjangoQuerySetPrivate::sqlValues(const QStringList &fields)
             fieldPos.insert(localFields[i].name(), i);
     } else {
         foreach (const QString &name, fields) {
-            int pos = 0;
-            foreach (const QDjangoMetaField &field, localFields) {
-                if (field.name() == name)
-                    break;
-                pos++;
-            }
-            Q_ASSERT_X(pos < localFields.size(), "QDjangoQuerySet<T>::values", "unknown field requested");
+            const int pos = metaModel.localFieldIndex(name.toLatin1());
+            Q_ASSERT_X(pos >= 0, "QDjangoQuerySet<T>::values", "unknown field requested");
             fieldPos.insert(name, pos);
         }
     }
@@ -543,7 +1096,7 @@ QList<QVariantList> QDjangoQuerySetPrivate::sqlValuesList(const QStringList &fie
     if (!sqlFetch())
         return values;
 
-    const QDjangoMetaModel metaModel = QDjango::metaModel(m_modelName);
+    const QDjangoMetaModel metaModel = this->metaModel();
 
     // build field list
     const QList<QDjangoMetaField> localFields = metaModel.localFields();
@@ -553,13 +1106,8 @@ QList<QVariantList> QDjangoQuerySetPrivate::sqlValuesList(const QStringList &fie
             fieldPos << i;
     } else {
         foreach (const QString &name, fields) {
-            int pos = 0;
-            foreach (const QDjangoMetaField &field, localFields) {
-                if (field.name() == name)
-                    break;
-                pos++;
-            }
-            Q_ASSERT_X(pos < localFields.size(), "QDjangoQuerySet<T>::valuesList", "unknown field requested");
+            const int pos = metaModel.localFieldIndex(name.toLatin1());
+            Q_ASSERT_X(pos >= 0, "QDjangoQuerySet<T>::valuesList", "unknown field requested");
             fieldPos << pos;
         }
     }
@@ -574,4 +1122,187 @@ QList<QVariantList> QDjangoQuerySetPrivate::sqlValuesList(const QStringList &fie
     return values;
 }
 
+static QAtomicInt globalCursorId(0);
+
+// returns true if a statement failed because it requires a transaction
+static bool isNoTransactionError(const QSqlError &error)
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
+    return error.nativeErrorCode() == QLatin1String("25P01");
+#else
+    return error.databaseText().contains(QLatin1String("transaction block"));
+#endif
+}
+
+QDjangoCursor::QDjangoCursor(const QDjangoQuerySetPrivate *querySet, int batchSize)
+    : m_querySet(querySet),
+    m_metaModel(querySet->metaModel()),
+    m_db(QDjango::database()),
+    m_query(m_db),
+    m_batchSize(qMax(1, batchSize)),
+    m_batchRows(0),
+    m_error(false),
+    m_open(false),
+    m_transaction(false)
+{
+}
+
+QDjangoCursor::~QDjangoCursor()
+{
+    close();
+}
+
+void QDjangoCursor::close()
+{
+    if (!m_open)
+        return;
+    m_open = false;
+
+    if (!m_name.isEmpty()) {
+        QDjangoQuery query(m_db);
+        if (!query.exec(QLatin1String("CLOSE ") + m_name))
+            m_error = true;
+        if (m_transaction && !m_db.commit())
+            m_error = true;
+    }
+}
+
+/** Executes the SELECT query and declares the cursor if applicable.
+ */
+bool QDjangoCursor::exec()
+{
+    // an empty queryset doesn't need a query
+    if (m_querySet->whereClause.isNone())
+        return true;
+
+    if (QDjangoDatabase::databaseType(m_db) == QDjangoDatabase::PostgreSQL) {
+        m_name = QLatin1String("qdjango_cursor_") + QString::number(globalCursorId.fetchAndAddOrdered(1));
+
+        QVariantList values;
+        const QString sql = QDjangoDatabase::inlineValues(m_db, m_querySet->selectSql(&values), values);
+        const QString declare = QLatin1String("DECLARE ") + m_name + QLatin1String(" NO SCROLL CURSOR FOR ") + sql;
+
+        // cursors without hold only exist inside a transaction, so one is
+        // opened, and later committed, only if the caller has none
+        QDjangoQuery query(m_db);
+        bool ok = query.exec(declare);
+        if (!ok && isNoTransactionError(query.lastError())) {
+            m_transaction = m_db.transaction();
+            ok = m_transaction && query.exec(declare);
+            if (!ok && m_transaction) {
+                m_db.rollback();
+                m_transaction = false;
+            }
+        }
+        if (!ok) {
+            m_error = true;
+            return false;
+        }
+        m_open = true;
+        return fetch();
+    } else {
+        m_query = m_querySet->selectQuery();
+        m_query.setForwardOnly(true);
+        if (!m_query.exec()) {
+            m_error = true;
+            return false;
+        }
+        m_open = true;
+        return true;
+    }
+}
+
+/** Fetches the next batch of rows from the server-side cursor.
+ */
+bool QDjangoCursor::fetch()
+{
+    m_batchRows = 0;
+    m_query = QDjangoQuery(m_db);
+    m_query.setForwardOnly(true);
+    if (!m_query.exec(QString::fromLatin1("FETCH FORWARD %1 FROM %2").arg(QString::number(m_batchSize), m_name))) {
+        m_error = true;
+        close();
+        return false;
+    }
+    return true;
+}
+
+/** Returns true if an error occured while streaming results.
+ */
+bool QDjangoCursor::hasError() const
+{
+    return m_error;
+}
+
+/** Loads the next row into the given \a model instance.
+ *
+ * \return true if a row was loaded, false if there are no more rows or
+ * an error occured.
+ */
+bool QDjangoCursor::next(QObject *model)
+{
+    if (!nextRow())
+        return false;
+    load(model);
+    return true;
+}
+
+/** Loads the next row into an \a object of a plain model, which does not
+ *  derive from QObject.
+ */
+bool QDjangoCursor::next(void *object)
+{
+    if (!nextRow())
+        return false;
+    load(object);
+    return true;
+}
+
+/** Fetches the next row without loading it, so that callers can allocate
+ *  the instance to load it into only once a row is available.
+ *
+ * \return true if a row was fetched, false if there are no more rows or
+ * an error occured.
+ */
+bool QDjangoCursor::nextRow()
+{
+    m_row.clear();
+    while (m_open) {
+        if (m_query.next()) {
+            m_batchRows++;
+
+            const int propCount = m_query.record().count();
+            m_row.reserve(propCount);
+            for (int i = 0; i < propCount; ++i)
+                m_row << m_query.value(i);
+            return true;
+        }
+
+        // a full batch means there may be more rows on the server
+        if (!m_name.isEmpty() && m_batchRows == m_batchSize) {
+            if (!fetch())
+                return false;
+        } else {
+            close();
+        }
+    }
+    return false;
+}
+
+/** Loads the row fetched by nextRow() into the given \a model instance.
+ */
+void QDjangoCursor::load(QObject *model)
+{
+    int pos = 0;
+    m_metaModel.load(model, m_row, pos);
+}
+
+/** Loads the row fetched by nextRow() into an \a object of a plain model.
+ */
+void QDjangoCursor::load(void *object)
+{
+    int pos = 0;
+    m_metaModel.load(object, m_row, pos);
+}
+
 /// \endcond
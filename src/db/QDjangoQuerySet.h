@@ -19,10 +19,94 @@
 #ifndef QDJANGO_QUERYSET_H
 #define QDJANGO_QUERYSET_H
 
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+#include <tuple>
+#include <vector>
+#endif
+
 #include "QDjango.h"
+#include "QDjangoModelArena.h"
 #include "QDjangoWhere.h"
 #include "QDjangoQuerySet_p.h"
 
+template <class T>
+    class QDjangoQuerySet;
+
+/** \internal
+ *
+ *  The QDjangoQuerySetRunnable class evaluates a QDjangoQuerySet in a worker
+ *  thread and invokes a callback on each of its objects.
+ */
+template <class T, class Function>
+    class QDjangoQuerySetRunnable : public QRunnable
+{
+public:
+    QDjangoQuerySetRunnable(const QDjangoQuerySet<T> &querySet, Function func, bool *ok)
+        : m_querySet(querySet)
+        , m_func(func)
+        , m_ok(ok)
+    {
+    }
+
+    void run()
+    {
+        const int size = m_querySet.size();
+        if (size < 0) {
+            *m_ok = false;
+            return;
+        }
+
+        T object;
+        for (int i = 0; i < size; ++i) {
+            if (m_querySet.at(i, &object))
+                m_func(object);
+        }
+        *m_ok = true;
+    }
+
+private:
+    QDjangoQuerySet<T> m_querySet;
+    Function m_func;
+    bool *m_ok;
+};
+
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+/// \cond
+
+template <int... Is>
+struct QDjangoIndexes
+{
+};
+
+template <int N, int... Is>
+struct QDjangoMakeIndexes : QDjangoMakeIndexes<N - 1, N - 1, Is...>
+{
+};
+
+template <int... Is>
+struct QDjangoMakeIndexes<0, Is...>
+{
+    typedef QDjangoIndexes<Is...> Type;
+};
+
+/** \internal
+ *
+ *  Converts the current row of \a query to a tuple.
+ */
+template <class... Ts, int... Is>
+inline std::tuple<Ts...> qdjangoTupleFromQuery(const QSqlQuery &query, QDjangoIndexes<Is...>)
+{
+    return std::tuple<Ts...>(qvariant_cast<Ts>(query.value(Is))...);
+}
+
+/// \endcond
+#endif
+
 /** \brief The QDjangoQuerySet class is a template class for performing
  *   database queries.
  *
@@ -299,13 +383,30 @@ public:
     QDjangoQuerySet selectRelated() const;
 
     int count() const;
+    int estimatedCount(int threshold = 1000) const;
+    int totalCount();
     QDjangoWhere where() const;
 
     bool remove();
+    bool bulkInsert(const QList<T*> &objects);
+    bool bulkRemove(const QList<T*> &objects);
     int size();
     int update(const QVariantMap &fields);
+    template <class Function>
+    bool forEach(Function func, int batchSize = 1000) const;
+    template <class Container>
+    bool load(Container &objects, int batchSize = 1000) const;
+    bool fetch(QDjangoModelArena &arena, QList<T*> *objects, int batchSize = 1000) const;
+    template <class Function>
+    bool parallelForEach(Function func, int workers = QThread::idealThreadCount()) const;
     QList<QVariantMap> values(const QStringList &fields = QStringList());
     QList<QVariantList> valuesList(const QStringList &fields = QStringList());
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+    template <class... Ts>
+    std::vector<std::tuple<Ts...> > valuesTuple(const QStringList &fields = QStringList()) const;
+    template <class... Ts, class Function>
+    bool valuesTuple(const QStringList &fields, Function func) const;
+#endif
 
     T *get(const QDjangoWhere &where, T *target = 0) const;
     T *at(int index, T *target = 0);
@@ -320,14 +421,21 @@ public:
 
 private:
     QDjangoQuerySetPrivate *d;
+    friend class QDjangoWhere;
 };
 
+template <class T>
+QDjangoWhere::QDjangoWhere(const QString &key, QDjangoWhere::Operation operation, const QDjangoQuerySet<T> &querySet)
+{
+    setSubQuery(key, operation, querySet.d);
+}
+
 /** Constructs a new queryset.
  */
 template <class T>
 QDjangoQuerySet<T>::QDjangoQuerySet()
 {
-    d = new QDjangoQuerySetPrivate(T::staticMetaObject.className());
+    d = new QDjangoQuerySetPrivate(QDjangoModelTraits<T>::className(), QDjango::metaModel<T>());
 }
 
 /** Constructs a copy of \a other.
@@ -437,18 +545,67 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::all() const
  *
  * \note If the QDjangoQuerySet is already fully fetched, this simply returns
  *  the number of objects.
+ *
+ * \sa QDjango::setCountCacheTimeout(), totalCount()
  */
 template <class T>
 int QDjangoQuerySet<T>::count() const
 {
     if (d->hasResults)
         return d->properties.size();
+    if (d->whereClause.isNone())
+        return 0;
 
     // execute COUNT query
-    QDjangoQuery query(d->countQuery());
-    if (!query.exec() || !query.next())
-        return -1;
-    return query.value(0).toInt();
+    return d->sqlCount();
+}
+
+/** Returns an estimate of the number of objects in the queryset, based on
+ *  the statistics kept by the database, or -1 if the query failed.
+ *
+ *  This avoids a full scan of large tables, for instance to display a
+ *  number of pages. Unfiltered sets use pg_class on PostgreSQL,
+ *  sqlite_stat1 on SQLite and information_schema on MySQL, filtered sets
+ *  use the planner's estimate on PostgreSQL.
+ *
+ *  If no estimate is available, or if it is below \a threshold, an exact
+ *  count() is performed instead.
+ *
+ * \param threshold
+ */
+template <class T>
+int QDjangoQuerySet<T>::estimatedCount(int threshold) const
+{
+    if (d->hasResults)
+        return d->properties.size();
+    if (d->whereClause.isNone())
+        return 0;
+
+    const int estimate = d->sqlEstimatedCount();
+    if (estimate >= 0 && estimate >= threshold)
+        return estimate;
+    return count();
+}
+
+/** Returns the number of objects in the queryset ignoring limit(), or -1
+ *  if the query failed.
+ *
+ *  This is intended for paginated views: if the QDjangoQuerySet is sliced
+ *  and the database supports window functions (PostgreSQL, SQLite 3.25,
+ *  MySQL 8.0), the current page is fetched along with the total in a
+ *  single statement using COUNT(*) OVER (). Otherwise, or if the page is
+ *  empty, a separate COUNT query is performed.
+ *
+ *  \code
+ *  QDjangoQuerySet<User> page = users.limit(offset, 20);
+ *  const int total = page.totalCount();
+ *  for (int i = 0; i < page.size(); ++i) ...
+ *  \endcode
+ */
+template <class T>
+int QDjangoQuerySet<T>::totalCount()
+{
+    return d->sqlTotalCount();
 }
 
 /** Returns a new QDjangoQuerySet containing objects for which the given key
@@ -487,6 +644,89 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::filter(const QDjangoWhere &where) const
     return other;
 }
 
+/** Invokes \a func on each object in the QDjangoQuerySet, streaming the
+ *  results from the database instead of caching them in the set.
+ *
+ *  On PostgreSQL a server-side cursor is used and rows are fetched in batches
+ *  of \a batchSize, so that memory usage stays bounded regardless of the
+ *  size of the set. The cursor is declared inside a transaction which is
+ *  committed once the set has been consumed, so you must not call this
+ *  method while a transaction is already open. On other databases, the
+ *  results are read using a forward-only query.
+ *
+ * \return true if all the queries succeeded, false otherwise
+ */
+template <class T>
+template <class Function>
+bool QDjangoQuerySet<T>::forEach(Function func, int batchSize) const
+{
+    QDjangoCursor cursor(d, batchSize);
+    if (!cursor.exec())
+        return false;
+
+    T object;
+    while (cursor.next(&object))
+        func(object);
+    return !cursor.hasError();
+}
+
+/** Replaces the contents of \a objects, for instance a std::vector<T> or a
+ *  QVector<T>, with the objects in the QDjangoQuerySet.
+ *
+ *  The rows are streamed as with forEach() and each of them is loaded in
+ *  place at the end of the container. Combined with a plain model which
+ *  does not derive from QObject, see QDjangoModelTraits, this stores the
+ *  whole set in contiguous memory without a heap allocation per object.
+ *
+ *  Returns false if the query failed.
+ *
+ * \param objects
+ * \param batchSize number of rows to fetch per round-trip
+ */
+template <class T>
+template <class Container>
+bool QDjangoQuerySet<T>::load(Container &objects, int batchSize) const
+{
+    objects.clear();
+
+    QDjangoCursor cursor(d, batchSize);
+    if (!cursor.exec())
+        return false;
+
+    while (cursor.nextRow()) {
+        objects.push_back(T());
+        cursor.load(&objects.back());
+    }
+    return !cursor.hasError();
+}
+
+/** Appends the objects in the QDjangoQuerySet to \a objects, allocating
+ *  them in the given \a arena.
+ *
+ *  The rows are streamed as with forEach(). The objects belong to the
+ *  arena and are freed along with it, so you must not delete them.
+ *
+ *  Returns false if the query failed.
+ *
+ * \param arena
+ * \param objects
+ * \param batchSize number of rows to fetch per round-trip
+ */
+template <class T>
+bool QDjangoQuerySet<T>::fetch(QDjangoModelArena &arena, QList<T*> *objects, int batchSize) const
+{
+    QDjangoCursor cursor(d, batchSize);
+    if (!cursor.exec())
+        return false;
+
+    while (cursor.nextRow()) {
+        T *object = arena.create<T>();
+        cursor.load(object);
+        objects->append(object);
+    }
+    return !cursor.hasError();
+}
+
 /** Returns the object in the QDjangoQuerySet for which the given
  *  where condition is true.
  *
@@ -564,6 +804,58 @@ QDjangoQuerySet<T> QDjangoQuerySet<T>::orderBy(const QStringList &keys) const
     return other;
 }
 
+/** Invokes \a func on each object in the QDjangoQuerySet, evaluating the set
+ *  concurrently using up to \a workers threads.
+ *
+ *  The set is split into disjoint ranges of primary key values, each of which
+ *  is fetched by a worker thread using its own database connection. The
+ *  order in which objects are passed to \a func is unspecified and \a func
+ *  may be called from several threads at once, so it must be thread-safe.
+ *  Each worker uses its own copy of \a func.
+ *
+ *  If the set cannot be split, for instance because it has a limit, because
+ *  its primary key is not an integer or because the database is an in-memory
+ *  SQLite database, the objects are processed in the calling thread.
+ *
+ *  \code
+ *  struct Callback {
+ *      void operator()(const User &user) { ... }
+ *  };
+ *  QDjangoQuerySet<User>().parallelForEach(Callback(), 4);
+ *  \endcode
+ *
+ * \return true if all the queries succeeded, false otherwise
+ */
+template <class T>
+template <class Function>
+bool QDjangoQuerySet<T>::parallelForEach(Function func, int workers) const
+{
+    QList<QPair<QVariant, QVariant> > ranges;
+    if (!d->sqlPkRanges(workers, &ranges))
+        return false;
+
+    // the set could not be split, process it in the calling thread
+    if (ranges.size() == 1 && ranges.first().first.isNull()) {
+        bool ok = false;
+        QDjangoQuerySetRunnable<T, Function> runnable(*this, func, &ok);
+        runnable.run();
+        return ok;
+    }
+
+    QVector<bool> results(ranges.size(), false);
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, workers));
+    for (int i = 0; i < ranges.size(); ++i) {
+        const QDjangoQuerySet<T> rangeSet = filter(
+            QDjangoWhere(QLatin1String("pk"), QDjangoWhere::GreaterOrEquals, ranges[i].first) &&
+            QDjangoWhere(QLatin1String("pk"), QDjangoWhere::LessOrEquals, ranges[i].second));
+        pool.start(new QDjangoQuerySetRunnable<T, Function>(rangeSet, func, &results[i]));
+    }
+    pool.waitForDone();
+
+    return !results.contains(false);
+}
+
 /** Deletes all objects in the QDjangoQuerySet.
  *
  * \return true if deletion succeeded, false otherwise
@@ -574,6 +866,61 @@ bool QDjangoQuerySet<T>::remove()
     return d->sqlDelete();
 }
 
+/** Inserts the given \a objects into the database using a single batch
+ *  statement, whose values are bound column-wise.
+ *
+ *  Unlike QDjangoModel::save(), this does not check whether the objects
+ *  already exist and does not retrieve auto-incremented primary keys.
+ *
+ * \return true if insertion succeeded, false otherwise
+ */
+template <class T>
+bool QDjangoQuerySet<T>::bulkInsert(const QList<T*> &objects)
+{
+    QList<typename QDjangoModelCast<T>::Pointer> models;
+    models.reserve(objects.size());
+    foreach (T *object, objects)
+        models << object;
+
+    const QDjangoMetaModel metaModel = QDjango::metaModel<T>();
+    if (!metaModel.bulkInsert(models))
+        return false;
+
+    // invalidate cache
+    if (d->hasResults) {
+        d->properties.clear();
+        d->hasResults = false;
+    }
+    return true;
+}
+
+/** Deletes the given \a objects from the database by primary key using a
+ *  single batch statement.
+ *
+ *  The filters of the QDjangoQuerySet are not taken into account.
+ *
+ * \return true if deletion succeeded, false otherwise
+ */
+template <class T>
+bool QDjangoQuerySet<T>::bulkRemove(const QList<T*> &objects)
+{
+    QList<typename QDjangoModelCast<T>::Pointer> models;
+    models.reserve(objects.size());
+    foreach (T *object, objects)
+        models << object;
+
+    const QDjangoMetaModel metaModel = QDjango::metaModel<T>();
+    if (!metaModel.bulkRemove(models))
+        return false;
+
+    // invalidate cache
+    if (d->hasResults) {
+        d->properties.clear();
+        d->hasResults = false;
+    }
+    return true;
+}
+
 /** Returns a QDjangoQuerySet that will automatically "follow" foreign-key
  *  relationships, selecting that additional related-object data when it
  *  executes its query.
@@ -632,6 +979,72 @@ QList<QVariantList> QDjangoQuerySet<T>::valuesList(const QStringList &fields)
     return d->sqlValuesList(fields);
 }
 
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+/** Returns the given \a fields of the objects in the QDjangoQuerySet as
+ *  tuples of type std::tuple<Ts...>. If no \a fields are specified, all
+ *  the model's fields are returned in the order they were declared.
+ *
+ *  Unlike valuesList(), only the requested columns are selected and each
+ *  row is converted straight to its tuple, without building intermediate
+ *  lists of QVariant:
+ *
+ * \code
+ * std::vector<std::tuple<QString, bool> > rows =
+ *     users.valuesTuple<QString, bool>(QStringList() << "username" << "is_active");
+ * \endcode
+ *
+ *  Returns an empty vector if the query failed.
+ *
+ * \param fields
+ */
+template <class T>
+template <class... Ts>
+std::vector<std::tuple<Ts...> > QDjangoQuerySet<T>::valuesTuple(const QStringList &fields) const
+{
+    Q_ASSERT_X(fields.isEmpty() || fields.size() == int(sizeof...(Ts)), "QDjangoQuerySet<T>::valuesTuple", "field count does not match tuple size");
+
+    std::vector<std::tuple<Ts...> > values;
+    if (d->whereClause.isNone())
+        return values;
+
+    QDjangoQuery query(d->valuesQuery(fields));
+    if (!query.exec())
+        return values;
+    while (query.next())
+        values.push_back(qdjangoTupleFromQuery<Ts...>(query, typename QDjangoMakeIndexes<sizeof...(Ts)>::Type()));
+    return values;
+}
+
+/** Calls \a func with a std::tuple<Ts...> holding the given \a fields
+ *  of each object in the QDjangoQuerySet, as they are read from the
+ *  database.
+ *
+ *  This is the streaming counterpart of valuesTuple(const QStringList&):
+ *  no rows are retained once \a func has returned.
+ *
+ *  Returns false if the query failed.
+ *
+ * \param fields
+ * \param func
+ */
+template <class T>
+template <class... Ts, class Function>
+bool QDjangoQuerySet<T>::valuesTuple(const QStringList &fields, Function func) const
+{
+    Q_ASSERT_X(fields.isEmpty() || fields.size() == int(sizeof...(Ts)), "QDjangoQuerySet<T>::valuesTuple", "field count does not match tuple size");
+
+    if (d->whereClause.isNone())
+        return true;
+
+    QDjangoQuery query(d->valuesQuery(fields));
+    if (!query.exec())
+        return false;
+    while (query.next())
+        func(qdjangoTupleFromQuery<Ts...>(query, typename QDjangoMakeIndexes<sizeof...(Ts)>::Type()));
+    return true;
+}
+#endif
+
 /** Returns the QDjangoWhere expressing the WHERE clause of the
  * QDjangoQuerySet.
  */
@@ -54,23 +54,67 @@ public:
     QString rightHandKey;
 };
 
+/** \internal
+ *
+ *  A model traversed when resolving a field lookup.
+ */
+class QDJANGO_EXPORT QDjangoColumnPathStep
+{
+public:
+    QDjangoColumnPathStep()
+        : nullable(false)
+        , reverse(false)
+    {
+    }
+
+    QString modelPath;
+    QDjangoMetaModel metaModel;
+    bool nullable;
+    bool reverse;
+    QDjangoReverseReference reverseReference;
+};
+
+/** \internal
+ *
+ *  The joins and the escaped column a field lookup resolves to.
+ */
+class QDJANGO_EXPORT QDjangoColumnPath
+{
+public:
+    QList<QDjangoColumnPathStep> steps;
+    QString column;
+};
+
 /** \internal
  */
 class QDJANGO_EXPORT QDjangoCompiler
 {
 public:
     QDjangoCompiler(const char *modelName, const QSqlDatabase &db);
+    QDjangoCompiler(const QDjangoMetaModel &model, const QSqlDatabase &db);
+    void appendFrom(QDjangoSqlBuilder &sql);
+    void appendOrderLimit(QDjangoSqlBuilder &sql, const QStringList &orderBy, int lowMark, int highMark);
+    void appendWhere(QDjangoSqlBuilder &sql, const QDjangoWhere &where);
     QString fromSql();
     QStringList fieldNames(bool recurse, QDjangoMetaModel *metaModel = 0, const QString &modelPath = QString(), bool nullable = false);
+    QStringList fieldColumns(const QStringList &names);
     QString orderLimitSql(const QStringList &orderBy, int lowMark, int highMark);
     void resolve(QDjangoWhere &where);
 
+    static void clearColumnPaths();
+
 private:
     QString databaseColumn(const QString &name);
+    bool resolveColumnPath(const QString &name, QDjangoColumnPath *path) const;
     QString referenceModel(const QString &modelPath, QDjangoMetaModel *metaModel, bool nullable);
 
+    QSqlDatabase database;
     QSqlDriver *driver;
+    QString aliasPrefix;
+    int subQueryCount;
     QDjangoMetaModel baseModel;
+    // looked up once, baseModel keeps it alive
+    const QDjangoMetaModelIdentifiers &identifiers;
     QMap<QString, QDjangoModelReference> modelRefs;
     QMap<QString, QDjangoReverseReference> reverseModelRefs;
     QMap<QString, QString> fieldColumnCache;
@@ -81,24 +125,36 @@ private:
 class QDJANGO_EXPORT QDjangoQuerySetPrivate
 {
 public:
-    QDjangoQuerySetPrivate(const char *modelName);
+    QDjangoQuerySetPrivate(const char *modelName, const QDjangoMetaModel &metaModel = QDjangoMetaModel());
 
     void addFilter(const QDjangoWhere &where);
     QDjangoWhere resolvedWhere(const QSqlDatabase &db) const;
+    bool sqlBulkDelete(const QVariantList &pks);
+    bool sqlBulkInsert(const QList<QVariantMap> &rows);
+    int sqlCount(bool limited = true);
     bool sqlDelete();
+    int sqlEstimatedCount();
     bool sqlFetch();
     bool sqlInsert(const QVariantMap &fields, QVariant *insertId = 0);
     bool sqlLoad(QObject *model, int index);
+    bool sqlLoad(void *object, int index);
+    bool sqlPkRanges(int count, QList<QPair<QVariant, QVariant> > *ranges);
+    int sqlTotalCount();
     int sqlUpdate(const QVariantMap &fields);
     QList<QVariantMap> sqlValues(const QStringList &fields);
     QList<QVariantList> sqlValuesList(const QStringList &fields);
 
     // SQL queries
-    QDjangoQuery countQuery() const;
+    QDjangoQuery bulkDeleteQuery(const QVariantList &pks) const;
+    QDjangoQuery bulkInsertQuery(const QList<QVariantMap> &rows) const;
+    QDjangoQuery countQuery(bool limited = true) const;
     QDjangoQuery deleteQuery() const;
     QDjangoQuery insertQuery(const QVariantMap &fields) const;
-    QDjangoQuery selectQuery() const;
+    QDjangoQuery pkRangeQuery() const;
+    QDjangoQuery selectQuery(bool withTotal = false) const;
+    QString selectSql(QVariantList *values, bool withTotal = false) const;
     QDjangoQuery updateQuery(const QVariantMap &fields) const;
+    QDjangoQuery valuesQuery(const QStringList &fields) const;
 
     // reference counter
     QAtomicInt counter;
@@ -110,13 +166,62 @@ public:
     QStringList orderBy;
     QList<QVariantList> properties;
     bool selectRelated;
+    int total;
 
 private:
     Q_DISABLE_COPY(QDjangoQuerySetPrivate)
+    QString countCacheKey(bool limited) const;
+    QString insertSql(const QSqlDatabase &db, const QStringList &names) const;
+    bool fetchRow(int index);
+    QDjangoMetaModel metaModel() const;
 
     QByteArray m_modelName;
+    QDjangoMetaModel m_metaModel;
 
+    friend class QDjangoCursor;
     friend class QDjangoMetaModel;
+    friend class QDjangoWhere;
+};
+
+/** \internal
+ *
+ *  The QDjangoCursor class streams the results of a SELECT on a
+ *  QDjangoQuerySetPrivate without caching them.
+ *
+ *  On PostgreSQL a server-side cursor is declared inside a transaction and
+ *  rows are fetched in batches, on other databases a forward-only query is
+ *  used.
+ */
+class QDJANGO_EXPORT QDjangoCursor
+{
+public:
+    QDjangoCursor(const QDjangoQuerySetPrivate *querySet, int batchSize);
+    ~QDjangoCursor();
+
+    bool exec();
+    bool hasError() const;
+    bool next(QObject *model);
+    bool next(void *object);
+    bool nextRow();
+    void load(QObject *model);
+    void load(void *object);
+
+private:
+    Q_DISABLE_COPY(QDjangoCursor)
+    void close();
+    bool fetch();
+
+    const QDjangoQuerySetPrivate *m_querySet;
+    QDjangoMetaModel m_metaModel;
+    QSqlDatabase m_db;
+    QDjangoQuery m_query;
+    QString m_name;
+    int m_batchSize;
+    int m_batchRows;
+    bool m_error;
+    bool m_open;
+    bool m_transaction;
+    QVariantList m_row;
 };
 
 #endif
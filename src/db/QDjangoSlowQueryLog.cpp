@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <QFile>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
+#include <QTextStream>
+
+#include "QDjango.h"
+#include "QDjangoSlowQueryLog.h"
+
+/// \cond
+
+class QDjangoSlowQueryLogPrivate
+{
+public:
+    QString explain(const QDjangoQueryEvent &event) const;
+    void write(const QDjangoSlowQueryLog::Entry &entry);
+
+    int capacity;
+    bool explainEnabled;
+    QString fileName;
+    int maxFiles;
+    qint64 maxSize;
+    bool redactionEnabled;
+    int threshold;
+
+    QList<QDjangoSlowQueryLog::Entry> entries;
+    QMutex mutex;
+};
+
+QString QDjangoSlowQueryLogPrivate::explain(const QDjangoQueryEvent &event) const
+{
+    // EXPLAIN does not support DDL or transaction statements
+    const QString verb = event.sql.trimmed().section(QLatin1Char(' '), 0, 0).toUpper();
+    if (verb != QLatin1String("SELECT") &&
+        verb != QLatin1String("INSERT") &&
+        verb != QLatin1String("UPDATE") &&
+        verb != QLatin1String("DELETE"))
+        return QString();
+
+    // explain the statement on the connection which executed it
+    QSqlDatabase db = QSqlDatabase::database(event.connectionName, false);
+    if (!db.isOpen())
+        return QString();
+    const QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    QString prefix;
+    switch (databaseType) {
+    case QDjangoDatabase::SQLite:
+        prefix = QLatin1String("EXPLAIN QUERY PLAN ");
+        break;
+    case QDjangoDatabase::PostgreSQL:
+        prefix = QLatin1String("EXPLAIN (FORMAT JSON) ");
+        break;
+    case QDjangoDatabase::MySqlServer:
+        prefix = QLatin1String("EXPLAIN ");
+        break;
+    default:
+        return QString();
+    }
+
+    // use a plain QSqlQuery so that the EXPLAIN is not itself observed
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (databaseType == QDjangoDatabase::PostgreSQL) {
+        // the PostgreSQL driver turns prepared statements into PREPARE,
+        // which does not accept EXPLAIN
+        const QString sql = QDjangoDatabase::inlineValues(db, event.sql, event.boundValues);
+        if (!query.exec(prefix + sql))
+            return QString();
+    } else {
+        if (!query.prepare(prefix + event.sql))
+            return QString();
+        foreach (const QVariant &value, event.boundValues)
+            query.addBindValue(value);
+        if (!query.exec())
+            return QString();
+    }
+
+    // SQLite describes each step in its "detail" column, other
+    // databases get one line per row with all columns
+    QStringList lines;
+    while (query.next()) {
+        const QSqlRecord record = query.record();
+        const int detail = record.indexOf(QLatin1String("detail"));
+        if (detail >= 0) {
+            lines << query.value(detail).toString();
+        } else {
+            QStringList values;
+            for (int i = 0; i < record.count(); ++i)
+                values << query.value(i).toString();
+            lines << values.join(QLatin1String("\t"));
+        }
+    }
+    return lines.join(QLatin1String("\n"));
+}
+
+void QDjangoSlowQueryLogPrivate::write(const QDjangoSlowQueryLog::Entry &entry)
+{
+    // rotate the log: file -> file.1 -> file.2 ...
+    QFile file(fileName);
+    if (maxSize > 0 && file.exists() && file.size() >= maxSize) {
+        QFile::remove(fileName + QLatin1Char('.') + QString::number(maxFiles));
+        for (int i = maxFiles - 1; i > 0; --i) {
+            QFile::rename(fileName + QLatin1Char('.') + QString::number(i),
+                          fileName + QLatin1Char('.') + QString::number(i + 1));
+        }
+        if (maxFiles > 0)
+            QFile::rename(fileName, fileName + QLatin1String(".1"));
+        else
+            QFile::remove(fileName);
+    }
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qWarning("Could not open slow query log %s", qPrintable(fileName));
+        return;
+    }
+
+    QStringList values;
+    foreach (const QVariant &value, entry.boundValues)
+        values << value.toString();
+
+    QTextStream stream(&file);
+    stream << entry.timestamp.toString(Qt::ISODate) << " "
+           << QString::number(entry.duration / 1000000.0, 'f', 3) << " ms\n";
+    stream << "  SQL: " << entry.sql << "\n";
+    if (!values.isEmpty())
+        stream << "  VALUES: " << values.join(QLatin1String(", ")) << "\n";
+    if (!entry.plan.isEmpty()) {
+        stream << "  PLAN:\n";
+        foreach (const QString &line, entry.plan.split(QLatin1Char('\n')))
+            stream << "    " << line << "\n";
+    }
+}
+
+/// \endcond
+
+/*!
+    Constructs an empty Entry.
+*/
+QDjangoSlowQueryLog::Entry::Entry()
+    : duration(0)
+{
+}
+
+/*!
+    Constructs a new slow query log which records statements taking at
+    least \a threshold milliseconds, and keeps the last \a capacity of them
+    in memory.
+*/
+QDjangoSlowQueryLog::QDjangoSlowQueryLog(int threshold, int capacity)
+    : d(new QDjangoSlowQueryLogPrivate)
+{
+    d->capacity = capacity;
+    d->explainEnabled = true;
+    d->maxFiles = 5;
+    d->maxSize = 0;
+    d->redactionEnabled = false;
+    d->threshold = threshold;
+}
+
+/*!
+    Destroys the slow query log.
+
+    You must remove it from the query observers before destroying it.
+*/
+QDjangoSlowQueryLog::~QDjangoSlowQueryLog()
+{
+    delete d;
+}
+
+/*!
+    Returns the maximum number of entries kept in memory.
+*/
+int QDjangoSlowQueryLog::capacity() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->capacity;
+}
+
+/*!
+    Sets the maximum number of entries kept in memory. Once it is reached,
+    the oldest entry is discarded for each new entry.
+
+    \param capacity
+*/
+void QDjangoSlowQueryLog::setCapacity(int capacity)
+{
+    QMutexLocker locker(&d->mutex);
+    d->capacity = capacity;
+    while (d->entries.size() > qMax(capacity, 0))
+        d->entries.removeFirst();
+}
+
+/*!
+    Returns the entries kept in memory, from oldest to newest.
+*/
+QList<QDjangoSlowQueryLog::Entry> QDjangoSlowQueryLog::entries() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->entries;
+}
+
+/*!
+    Discards the entries kept in memory.
+*/
+void QDjangoSlowQueryLog::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->entries.clear();
+}
+
+/*!
+    Returns the name of the file to which entries are appended, or an
+    empty string if entries are only kept in memory.
+*/
+QString QDjangoSlowQueryLog::fileName() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->fileName;
+}
+
+/*!
+    Sets the name of the file to which entries are appended.
+
+    Once the file reaches \a maxSize bytes, it is renamed with a ".1"
+    suffix, older files are shifted and only \a maxFiles of them are
+    kept. If \a maxSize is 0, the file is never rotated.
+
+    \param fileName
+    \param maxSize
+    \param maxFiles
+*/
+void QDjangoSlowQueryLog::setFileName(const QString &fileName, qint64 maxSize, int maxFiles)
+{
+    QMutexLocker locker(&d->mutex);
+    d->fileName = fileName;
+    d->maxSize = maxSize;
+    d->maxFiles = maxFiles;
+}
+
+/*!
+    Returns whether the query plan of slow statements is captured.
+*/
+bool QDjangoSlowQueryLog::isExplainEnabled() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->explainEnabled;
+}
+
+/*!
+    Sets whether the query plan of slow statements is captured.
+
+    \param enabled
+*/
+void QDjangoSlowQueryLog::setExplainEnabled(bool enabled)
+{
+    QMutexLocker locker(&d->mutex);
+    d->explainEnabled = enabled;
+}
+
+/*!
+    Returns whether bound values are redacted.
+*/
+bool QDjangoSlowQueryLog::isRedactionEnabled() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->redactionEnabled;
+}
+
+/*!
+    Sets whether bound values are redacted, in which case they are
+    neither kept in memory nor written to the log file. The query plan
+    is still captured using the actual values.
+
+    \param enabled
+*/
+void QDjangoSlowQueryLog::setRedactionEnabled(bool enabled)
+{
+    QMutexLocker locker(&d->mutex);
+    d->redactionEnabled = enabled;
+}
+
+/*!
+    Returns the duration in milliseconds from which statements are logged.
+*/
+int QDjangoSlowQueryLog::threshold() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->threshold;
+}
+
+/*!
+    Sets the duration in milliseconds from which statements are logged.
+
+    \param threshold
+*/
+void QDjangoSlowQueryLog::setThreshold(int threshold)
+{
+    QMutexLocker locker(&d->mutex);
+    d->threshold = threshold;
+}
+
+/*!
+    Records the statement described by \a event if its total duration
+    reaches the threshold.
+*/
+void QDjangoSlowQueryLog::queryExecuted(const QDjangoQueryEvent &event)
+{
+    const qint64 duration = event.prepareTime + event.executionTime + event.fetchTime;
+
+    bool explainEnabled;
+    bool redactionEnabled;
+    {
+        QMutexLocker locker(&d->mutex);
+        if (duration < qint64(d->threshold) * 1000000)
+            return;
+        explainEnabled = d->explainEnabled;
+        redactionEnabled = d->redactionEnabled;
+    }
+
+    Entry entry;
+    entry.timestamp = QDateTime::currentDateTime();
+    entry.sql = event.sql;
+    entry.duration = duration;
+    if (redactionEnabled) {
+        for (int i = 0; i < event.boundValues.size(); ++i)
+            entry.boundValues << QVariant(QLatin1String("?"));
+    } else {
+        entry.boundValues = event.boundValues;
+    }
+
+    // the plan is captured outside the lock, as EXPLAIN can take a while
+    if (explainEnabled && event.success)
+        entry.plan = d->explain(event);
+
+    QMutexLocker locker(&d->mutex);
+    if (d->capacity > 0) {
+        if (d->entries.size() >= d->capacity)
+            d->entries.removeFirst();
+        d->entries << entry;
+    }
+    if (!d->fileName.isEmpty())
+        d->write(entry);
+}
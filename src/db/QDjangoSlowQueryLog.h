@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef QDJANGO_SLOW_QUERY_LOG_H
+#define QDJANGO_SLOW_QUERY_LOG_H
+
+#include <QDateTime>
+#include <QList>
+
+#include "QDjangoQueryObserver.h"
+
+class QDjangoSlowQueryLogPrivate;
+
+/** \brief The QDjangoSlowQueryLog class records the SQL statements which
+ *  exceed a duration threshold, along with their query plan.
+ *
+ *  The plan is captured by running EXPLAIN on the same connection as soon
+ *  as the statement completes: EXPLAIN QUERY PLAN on SQLite, EXPLAIN
+ *  (FORMAT JSON) on PostgreSQL and EXPLAIN on MySQL. Other databases are
+ *  logged without a plan.
+ *
+ *  The most recent entries are kept in memory, up to capacity(), and can
+ *  also be appended to a log file which is rotated once it reaches a
+ *  given size.
+ *
+ *  \code
+ *  QDjangoSlowQueryLog slowLog;
+ *  slowLog.setThreshold(100);
+ *  slowLog.setFileName("slow-queries.log");
+ *  QDjango::addQueryObserver(&slowLog);
+ *  \endcode
+ *
+ * \ingroup Database
+ */
+class QDJANGO_EXPORT QDjangoSlowQueryLog : public QDjangoQueryObserver
+{
+public:
+    /** \brief The Entry class describes a slow statement.
+     */
+    class Entry
+    {
+    public:
+        Entry();
+
+        /** The time at which the statement completed. */
+        QDateTime timestamp;
+
+        /** The SQL of the statement. */
+        QString sql;
+
+        /** The values bound to the statement, or "?" for each of them if
+         *  values are redacted. */
+        QVariantList boundValues;
+
+        /** The total duration of the statement in nanoseconds, including
+         *  preparation and fetching. */
+        qint64 duration;
+
+        /** The query plan reported by the database. */
+        QString plan;
+    };
+
+    QDjangoSlowQueryLog(int threshold = 100, int capacity = 100);
+    ~QDjangoSlowQueryLog();
+
+    int capacity() const;
+    void setCapacity(int capacity);
+
+    QList<Entry> entries() const;
+    void clear();
+
+    QString fileName() const;
+    void setFileName(const QString &fileName, qint64 maxSize = 1048576, int maxFiles = 5);
+
+    bool isExplainEnabled() const;
+    void setExplainEnabled(bool enabled);
+
+    bool isRedactionEnabled() const;
+    void setRedactionEnabled(bool enabled);
+
+    int threshold() const;
+    void setThreshold(int threshold);
+
+    void queryExecuted(const QDjangoQueryEvent &event);
+
+private:
+    Q_DISABLE_COPY(QDjangoSlowQueryLog)
+    QDjangoSlowQueryLogPrivate* const d;
+};
+
+#endif
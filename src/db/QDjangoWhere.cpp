@@ -15,10 +15,14 @@
  * Lesser General Public License for more details.
  */
 
+#include <QMap>
+#include <QSqlDriver>
+#include <QSqlField>
 #include <QStringList>
 #include <QDebug>
 
 #include "QDjango.h"
+#include "QDjangoQuerySet_p.h"
 #include "QDjangoWhere.h"
 #include "QDjangoWhere_p.h"
 
@@ -30,6 +34,125 @@ static QString escapeLike(const QString &data)
     return escaped;
 }
 
+// lists with more values than this are not bound as individual values
+static const int inListThreshold = 500;
+
+// maximum number of values in each IN of a chunked list
+static const int inListChunkSize = 500;
+
+enum InListStrategy
+{
+    InListValues,
+    InListArray,
+    InListJson,
+    InListLiterals,
+    InListChunks
+};
+
+static InListStrategy inListStrategy(const QSqlDatabase &db, int size)
+{
+    if (size <= inListThreshold)
+        return InListValues;
+
+    QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    if (databaseType == QDjangoDatabase::PostgreSQL)
+        return InListArray;
+    else if (databaseType == QDjangoDatabase::SQLite && QDjangoDatabase::hasJsonSupport(db))
+        return InListJson;
+    else if (databaseType == QDjangoDatabase::SQLite)
+        // older builds also cap the number of bound values at 999
+        return InListLiterals;
+    else
+        return InListChunks;
+}
+
+static QString listValueString(const QVariant &value)
+{
+    // store times as local times, like QDjangoQuery::addBindValue() does,
+    // keeping the milliseconds which Qt::ISODate drops
+    if (value.type() == QVariant::DateTime)
+        return value.toDateTime().toLocalTime().toString(QLatin1String("yyyy-MM-ddTHH:mm:ss.zzz"));
+    return value.toString();
+}
+
+// SQL literal formatted by the driver, e.g. 'it''s'
+static QString sqlLiteral(const QSqlDatabase &db, const QVariant &value)
+{
+    // SQLite compares times as text, so quote them like the JSON path does
+    if (value.type() == QVariant::DateTime) {
+        QSqlField field(QLatin1String("value"), QVariant::String);
+        field.setValue(listValueString(value));
+        return db.driver()->formatValue(field);
+    }
+    QSqlField field(QLatin1String("value"), value.type());
+    field.setValue(value);
+    return db.driver()->formatValue(field);
+}
+
+// PostgreSQL array literal, e.g. {"1","2"}
+static QString arrayLiteral(const QVariantList &values)
+{
+    QStringList bits;
+    foreach (const QVariant &value, values) {
+        if (value.isNull()) {
+            bits << QLatin1String("NULL");
+        } else {
+            QString escaped = listValueString(value);
+            escaped.replace(QLatin1String("\\"), QLatin1String("\\\\"));
+            escaped.replace(QLatin1String("\""), QLatin1String("\\\""));
+            bits << QLatin1Char('"') + escaped + QLatin1Char('"');
+        }
+    }
+    return QLatin1Char('{') + bits.join(QLatin1String(",")) + QLatin1Char('}');
+}
+
+// JSON array, e.g. [1,"a"]
+static QString jsonArray(const QVariantList &values)
+{
+    QStringList bits;
+    foreach (const QVariant &value, values) {
+        if (value.isNull()) {
+            bits << QLatin1String("null");
+            continue;
+        }
+
+        switch (value.type()) {
+        case QVariant::Bool:
+            bits << QLatin1String(value.toBool() ? "1" : "0");
+            break;
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+            bits << value.toString();
+            break;
+        case QVariant::Double:
+            bits << QString::number(value.toDouble(), 'g', 17);
+            break;
+        default:
+        {
+            const QString str = listValueString(value);
+            QString escaped = QLatin1String("\"");
+            for (int i = 0; i < str.size(); ++i) {
+                const QChar c = str.at(i);
+                if (c == QLatin1Char('"'))
+                    escaped += QLatin1String("\\\"");
+                else if (c == QLatin1Char('\\'))
+                    escaped += QLatin1String("\\\\");
+                else if (c.unicode() < 0x20)
+                    escaped += QString::fromLatin1("\\u%1").arg(c.unicode(), 4, 16, QLatin1Char('0'));
+                else
+                    escaped += c;
+            }
+            escaped += QLatin1Char('"');
+            bits << escaped;
+            break;
+        }
+        }
+    }
+    return QLatin1Char('[') + bits.join(QLatin1String(",")) + QLatin1Char(']');
+}
+
 /// \cond
 
 QDjangoWherePrivate::QDjangoWherePrivate()
@@ -39,6 +162,113 @@ QDjangoWherePrivate::QDjangoWherePrivate()
 {
 }
 
+bool QDjangoWherePrivate::isEqual(const QDjangoWhere &a, const QDjangoWhere &b)
+{
+    if (a.d == b.d)
+        return true;
+    if (a.d->combine != b.d->combine ||
+        a.d->operation != b.d->operation ||
+        a.d->negate != b.d->negate ||
+        a.d->key != b.d->key ||
+        a.d->subQuery != b.d->subQuery ||
+        a.d->data != b.d->data ||
+        a.d->children.size() != b.d->children.size())
+        return false;
+    for (int i = 0; i < a.d->children.size(); ++i) {
+        if (!isEqual(a.d->children[i], b.d->children[i]))
+            return false;
+    }
+    return true;
+}
+
+/* Returns true if the children of an AND node constrain the same column
+ * to disjoint sets of values.
+ *
+ * String values are left alone, as whether 'a' and 'A' are equal depends
+ * on the collation of the column.
+ */
+bool QDjangoWherePrivate::isImpossible(const QList<QDjangoWhere> &children)
+{
+    QMap<QString, QVariantList> allowed;
+    foreach (const QDjangoWhere &child, children) {
+        QVariantList values;
+        if (!valueList(child, &values))
+            continue;
+
+        bool comparable = true;
+        foreach (const QVariant &value, values) {
+            if (value.isNull() || value.type() == QVariant::String || value.type() == QVariant::ByteArray) {
+                comparable = false;
+                break;
+            }
+        }
+        if (!comparable)
+            continue;
+
+        if (!allowed.contains(child.d->key)) {
+            allowed.insert(child.d->key, values);
+            continue;
+        }
+
+        QVariantList common;
+        foreach (const QVariant &value, allowed.value(child.d->key)) {
+            if (values.contains(value))
+                common << value;
+        }
+        if (common.isEmpty())
+            return true;
+        allowed.insert(child.d->key, common);
+    }
+    return false;
+}
+
+/* Merges the equality tests of an OR node which apply to the same column
+ * into a single IsIn test.
+ */
+QList<QDjangoWhere> QDjangoWherePrivate::mergeEquals(const QList<QDjangoWhere> &children)
+{
+    QList<QDjangoWhere> merged;
+    QMap<QString, int> positions;
+    foreach (const QDjangoWhere &child, children) {
+        QVariantList values;
+        if (valueList(child, &values)) {
+            const QString key = child.d->key;
+            if (positions.contains(key)) {
+                const int pos = positions.value(key);
+                QVariantList existing;
+                valueList(merged[pos], &existing);
+                foreach (const QVariant &value, values) {
+                    if (!existing.contains(value))
+                        existing << value;
+                }
+                merged[pos] = QDjangoWhere(key, QDjangoWhere::IsIn, existing);
+                continue;
+            }
+            positions.insert(key, merged.size());
+        }
+        merged << child;
+    }
+    return merged;
+}
+
+/* If the given QDjangoWhere tests whether a column is equal to one of a
+ * list of values, stores the values and returns true.
+ */
+bool QDjangoWherePrivate::valueList(const QDjangoWhere &where, QVariantList *values)
+{
+    if (where.d->combine != NoCombine || where.d->negate || where.d->subQuery)
+        return false;
+
+    if (where.d->operation == QDjangoWhere::Equals) {
+        *values = QVariantList() << where.d->data;
+        return true;
+    } else if (where.d->operation == QDjangoWhere::IsIn) {
+        *values = where.d->data.toList();
+        return true;
+    }
+    return false;
+}
+
 /// \endcond
 
 /*!
@@ -92,6 +322,9 @@ QDjangoWherePrivate::QDjangoWherePrivate()
 
     \var QDjangoWhere::Operation QDjangoWhere::IsIn,
     Returns true if the column value is one of the given values.
+    Large lists of values are passed as a single array parameter on
+    PostgreSQL, as a JSON array on SQLite or split into several IN
+    clauses on other databases.
 
     \var QDjangoWhere::Operation QDjangoWhere::IsNull
     Returns true if the column value is null.
@@ -125,6 +358,45 @@ QDjangoWhere::QDjangoWhere(const QString &key, QDjangoWhere::Operation operation
     d->data = value;
 }
 
+/** \fn QDjangoWhere::QDjangoWhere(const QString &key, QDjangoWhere::Operation operation, const QDjangoQuerySet<T> &querySet)
+ *
+ * Constructs a QDjangoWhere expressing that a database column's value is one
+ * of the primary keys of the objects in \a querySet.
+ *
+ * The \a querySet is not evaluated, instead it is compiled to a subquery
+ * so that the primary keys are never transferred to the client:
+ *
+ * \code
+ * QDjangoQuerySet<User> activeUsers = users.filter(QDjangoWhere("is_active", QDjangoWhere::Equals, true));
+ * QDjangoQuerySet<Message> messages = QDjangoQuerySet<Message>().filter(
+ *     QDjangoWhere("user_id", QDjangoWhere::IsIn, activeUsers));
+ * \endcode
+ *
+ * \param key
+ * \param operation must be IsIn, other operations warn and match nothing
+ * \param querySet
+ */
+
+void QDjangoWhere::setSubQuery(const QString &key, QDjangoWhere::Operation operation, const QDjangoQuerySetPrivate *querySet)
+{
+    d = new QDjangoWherePrivate;
+    if (operation != IsIn) {
+        qWarning("QDjangoWhere subqueries can only be used with IsIn");
+        // match nothing rather than compare against the subquery's SQL
+        d->negate = true;
+        return;
+    }
+
+    d->key = key;
+    d->operation = operation;
+    d->subQuery = QSharedPointer<QDjangoSubQuery>(new QDjangoSubQuery);
+    d->subQuery->modelName = querySet->m_modelName;
+    d->subQuery->where = querySet->whereClause;
+    d->subQuery->orderBy = querySet->orderBy;
+    d->subQuery->lowMark = querySet->lowMark;
+    d->subQuery->highMark = querySet->highMark;
+}
+
 /** Destroys a QDjangoWhere.
  */
 QDjangoWhere::~QDjangoWhere()
@@ -256,10 +528,26 @@ QDjangoWhere QDjangoWhere::operator||(const QDjangoWhere &other) const
  */
 void QDjangoWhere::bindValues(QDjangoQuery &query) const
 {
-    if (d->operation == QDjangoWhere::IsIn) {
+    if (d->operation == QDjangoWhere::IsIn && d->subQuery) {
+        d->subQuery->where.bindValues(query);
+    } else if (d->operation == QDjangoWhere::IsIn) {
         const QList<QVariant> values = d->data.toList();
-        for (int i = 0; i < values.size(); i++)
-            query.addBindValue(values[i]);
+        switch (inListStrategy(QDjango::database(), values.size())) {
+        case InListArray:
+            query.addBindValue(arrayLiteral(values));
+            break;
+        case InListJson:
+            query.addBindValue(jsonArray(values));
+            break;
+        case InListLiterals:
+            // the values are part of the SQL
+            break;
+        case InListValues:
+        case InListChunks:
+            for (int i = 0; i < values.size(); i++)
+                query.addBindValue(values[i]);
+            break;
+        }
     } else if (d->operation == QDjangoWhere::IsNull) {
         // no data to bind
     } else if (d->operation == QDjangoWhere::StartsWith || d->operation == QDjangoWhere::IStartsWith) {
@@ -290,6 +578,75 @@ bool QDjangoWhere::isNone() const
     return d->combine == QDjangoWherePrivate::NoCombine && d->operation == None && d->negate == true;
 }
 
+/** Returns an equivalent QDjangoWhere in which nested AND / OR clauses
+ *  are flattened, duplicate tests are removed, "all" and "none" clauses
+ *  are folded and equality tests on the same column which are combined
+ *  with OR are merged into a single IsIn test.
+ *
+ *  If the constraint can never be satisfied, for instance because a
+ *  column is required to be equal to two different numbers, a QDjangoWhere
+ *  for which isNone() returns true is returned.
+ */
+QDjangoWhere QDjangoWhere::simplified() const
+{
+    if (d->combine == QDjangoWherePrivate::NoCombine) {
+        // an empty list of values never matches
+        if (d->operation == IsIn && !d->subQuery && d->data.toList().isEmpty())
+            return d->negate ? QDjangoWhere() : !QDjangoWhere();
+        return *this;
+    }
+
+    const bool isAnd = (d->combine == QDjangoWherePrivate::AndCombine);
+    const QDjangoWhere absorbing = isAnd ? !QDjangoWhere() : QDjangoWhere();
+
+    QList<QDjangoWhere> children;
+    foreach (const QDjangoWhere &child, d->children) {
+        const QDjangoWhere simple = child.simplified();
+        if (simple.d->combine == d->combine && !simple.d->negate)
+            children << simple.d->children;
+        else
+            children << simple;
+    }
+
+    QList<QDjangoWhere> folded;
+    foreach (const QDjangoWhere &child, children) {
+        if (isAnd ? child.isAll() : child.isNone())
+            continue;
+        if (isAnd ? child.isNone() : child.isAll())
+            return d->negate ? !absorbing : absorbing;
+
+        bool duplicate = false;
+        foreach (const QDjangoWhere &other, folded) {
+            if (QDjangoWherePrivate::isEqual(child, other)) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (!duplicate)
+            folded << child;
+    }
+
+    if (isAnd) {
+        if (QDjangoWherePrivate::isImpossible(folded))
+            return d->negate ? !absorbing : absorbing;
+    } else {
+        folded = QDjangoWherePrivate::mergeEquals(folded);
+    }
+
+    QDjangoWhere result;
+    if (folded.isEmpty()) {
+        // an AND of nothing matches everything, an OR of nothing matches nothing
+        if (!isAnd)
+            result = !result;
+    } else if (folded.size() == 1) {
+        result = folded.first();
+    } else {
+        result.d->combine = d->combine;
+        result.d->children = folded;
+    }
+    return d->negate ? !result : result;
+}
+
 /** Returns the SQL code corresponding for the current QDjangoWhere.
  */
 /* Note - SQLite is always case-insensitive because it can't figure out case when using non-Ascii charcters:
@@ -300,97 +657,157 @@ bool QDjangoWhere::isNone() const
  */
 QString QDjangoWhere::sql(const QSqlDatabase &db) const
 {
-    QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    QDjangoSqlBuilder sql;
+    QDjangoWherePrivate::appendSql(*this, sql, db, QDjangoDatabase::databaseType(db));
+    return sql.sql();
+}
+
+/// \cond
+
+void QDjangoWherePrivate::appendSql(const QDjangoWhere &where, QDjangoSqlBuilder &sql, const QSqlDatabase &db, QDjangoDatabase::DatabaseType databaseType)
+{
+    const QDjangoWherePrivate *d = where.d.constData();
 
     switch (d->operation) {
-        case Equals:
-            return d->key + QLatin1String(" = ?");
-        case NotEquals:
-            return d->key + QLatin1String(" != ?");
-        case GreaterThan:
-            return d->key + QLatin1String(" > ?");
-        case LessThan:
-            return d->key + QLatin1String(" < ?");
-        case GreaterOrEquals:
-            return d->key + QLatin1String(" >= ?");
-        case LessOrEquals:
-            return d->key + QLatin1String(" <= ?");
-        case IsIn:
+        case QDjangoWhere::Equals:
+            sql << d->key << QLatin1String(" = ?");
+            return;
+        case QDjangoWhere::NotEquals:
+            sql << d->key << QLatin1String(" != ?");
+            return;
+        case QDjangoWhere::GreaterThan:
+            sql << d->key << QLatin1String(" > ?");
+            return;
+        case QDjangoWhere::LessThan:
+            sql << d->key << QLatin1String(" < ?");
+            return;
+        case QDjangoWhere::GreaterOrEquals:
+            sql << d->key << QLatin1String(" >= ?");
+            return;
+        case QDjangoWhere::LessOrEquals:
+            sql << d->key << QLatin1String(" <= ?");
+            return;
+        case QDjangoWhere::IsIn:
         {
-            QStringList bits;
-            for (int i = 0; i < d->data.toList().size(); i++)
-                bits << QLatin1String("?");
-            if (d->negate)
-                return d->key + QString::fromLatin1(" NOT IN (%1)").arg(bits.join(QLatin1String(", ")));
-            else
-                return d->key + QString::fromLatin1(" IN (%1)").arg(bits.join(QLatin1String(", ")));
+            if (d->subQuery) {
+                sql << d->key << QLatin1String(d->negate ? " NOT IN (" : " IN (") << d->subQuery->sql << QLatin1Char(')');
+                return;
+            }
+
+            const int size = d->data.toList().size();
+            switch (inListStrategy(db, size)) {
+            case InListArray:
+                if (d->negate)
+                    sql << QLatin1String("NOT (") << d->key << QLatin1String(" = ANY(?))");
+                else
+                    sql << d->key << QLatin1String(" = ANY(?)");
+                return;
+            case InListJson:
+                sql << d->key << QLatin1String(d->negate ? " NOT IN" : " IN")
+                    << QLatin1String(" (SELECT value FROM json_each(?))");
+                return;
+            case InListLiterals:
+            {
+                const QVariantList values = d->data.toList();
+                sql << d->key << QLatin1String(d->negate ? " NOT IN (" : " IN (");
+                for (int i = 0; i < size; i++) {
+                    if (i)
+                        sql << QLatin1String(", ");
+                    sql << sqlLiteral(db, values.at(i));
+                }
+                sql << QLatin1Char(')');
+                return;
+            }
+            case InListChunks:
+                sql << QLatin1Char('(');
+                for (int start = 0; start < size; start += inListChunkSize) {
+                    if (start)
+                        sql << QLatin1String(d->negate ? " AND " : " OR ");
+                    sql << d->key << QLatin1String(d->negate ? " NOT IN (" : " IN (");
+                    for (int i = start; i < qMin(start + inListChunkSize, size); i++)
+                        sql << QLatin1String(i > start ? ", ?" : "?");
+                    sql << QLatin1Char(')');
+                }
+                sql << QLatin1Char(')');
+                return;
+            case InListValues:
+                break;
+            }
+
+            sql << d->key << QLatin1String(d->negate ? " NOT IN (" : " IN (");
+            for (int i = 0; i < size; i++)
+                sql << QLatin1String(i ? ", ?" : "?");
+            sql << QLatin1Char(')');
+            return;
         }
-        case IsNull:
-            return d->key + QLatin1String(d->data.toBool() ? " IS NULL" : " IS NOT NULL");
-        case StartsWith:
-        case EndsWith:
-        case Contains:
+        case QDjangoWhere::IsNull:
+            sql << d->key << QLatin1String(d->data.toBool() ? " IS NULL" : " IS NOT NULL");
+            return;
+        case QDjangoWhere::StartsWith:
+        case QDjangoWhere::EndsWith:
+        case QDjangoWhere::Contains:
         {
-            QString op;
+            sql << d->key << QLatin1Char(' ');
             if (databaseType == QDjangoDatabase::MySqlServer)
-                op = QLatin1String(d->negate ? "NOT LIKE BINARY" : "LIKE BINARY");
+                sql << QLatin1String(d->negate ? "NOT LIKE BINARY" : "LIKE BINARY");
             else
-                op = QLatin1String(d->negate ? "NOT LIKE" : "LIKE");
+                sql << QLatin1String(d->negate ? "NOT LIKE" : "LIKE");
             if (databaseType == QDjangoDatabase::SQLite)
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ? ESCAPE '\\'");
+                sql << QLatin1String(" ? ESCAPE '\\'");
             else
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ?");
+                sql << QLatin1String(" ?");
+            return;
         }
-        case IStartsWith:
-        case IEndsWith:
-        case IContains:
-        case IEquals:
-        {
-            const QString op = QLatin1String(d->negate ? "NOT LIKE" : "LIKE");
-            if (databaseType == QDjangoDatabase::SQLite)
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ? ESCAPE '\\'");
-            else if (databaseType == QDjangoDatabase::PostgreSQL)
-                return QLatin1String("UPPER(") + d->key + QLatin1String("::text) ") + op + QLatin1String(" UPPER(?)");
-            else
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ?");
-        }
-        case INotEquals:
+        case QDjangoWhere::IStartsWith:
+        case QDjangoWhere::IEndsWith:
+        case QDjangoWhere::IContains:
+        case QDjangoWhere::IEquals:
+        case QDjangoWhere::INotEquals:
         {
-            const QString op = QLatin1String(d->negate ? "LIKE" : "NOT LIKE");
+            // INotEquals is the negation of IEquals
+            const bool negate = (d->operation == QDjangoWhere::INotEquals) ? !d->negate : d->negate;
+            const bool equals = (d->operation == QDjangoWhere::IEquals || d->operation == QDjangoWhere::INotEquals);
+            const QLatin1String op(negate ? "NOT LIKE" : "LIKE");
             if (databaseType == QDjangoDatabase::SQLite)
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ? ESCAPE '\\'");
+                sql << d->key << QLatin1Char(' ') << op << QLatin1String(" ? ESCAPE '\\'");
+            else if (databaseType == QDjangoDatabase::PostgreSQL && equals)
+                // matches an index on lower(column), see the case_insensitive field option
+                sql << QLatin1String("lower(") << d->key << QLatin1String("::text) ") << QLatin1String(negate ? "!=" : "=") << QLatin1String(" lower(?)");
             else if (databaseType == QDjangoDatabase::PostgreSQL)
-                return QLatin1String("UPPER(") + d->key + QLatin1String("::text) ") + op + QLatin1String(" UPPER(?)");
+                sql << d->key << QLatin1String("::text ") << QLatin1String(negate ? "NOT ILIKE" : "ILIKE") << QLatin1String(" ?");
             else
-                return d->key + QLatin1String(" ") + op + QLatin1String(" ?");
+                sql << d->key << QLatin1Char(' ') << op << QLatin1String(" ?");
+            return;
         }
-        case None:
-            if (d->combine == QDjangoWherePrivate::NoCombine) {
-                return d->negate ? QLatin1String("1 != 0") : QString();
+        case QDjangoWhere::None:
+            if (d->combine == NoCombine) {
+                if (d->negate)
+                    sql << QLatin1String("1 != 0");
             } else {
-                QStringList bits;
-                foreach (const QDjangoWhere &child, d->children) {
-                    QString atom = child.sql(db);
-                    if (child.d->children.isEmpty())
-                        bits << atom;
-                    else
-                        bits << QString::fromLatin1("(%1)").arg(atom);
+                if (d->negate)
+                    sql << QLatin1String("NOT (");
+                const QLatin1String separator(d->combine == AndCombine ? " AND " : " OR ");
+                for (int i = 0; i < d->children.size(); ++i) {
+                    const QDjangoWhere &child = d->children.at(i);
+                    if (i)
+                        sql << separator;
+                    if (child.d->children.isEmpty()) {
+                        appendSql(child, sql, db, databaseType);
+                    } else {
+                        sql << QLatin1Char('(');
+                        appendSql(child, sql, db, databaseType);
+                        sql << QLatin1Char(')');
+                    }
                 }
-
-                QString combined;
-                if (d->combine == QDjangoWherePrivate::AndCombine)
-                    combined = bits.join(QLatin1String(" AND "));
-                else if (d->combine == QDjangoWherePrivate::OrCombine)
-                    combined = bits.join(QLatin1String(" OR "));
                 if (d->negate)
-                    combined = QString::fromLatin1("NOT (%1)").arg(combined);
-                return combined;
+                    sql << QLatin1Char(')');
             }
+            return;
     }
-
-    return QString();
 }
 
+/// \endcond
+
 QString QDjangoWhere::toString() const
 {
     if (d->combine == QDjangoWherePrivate::NoCombine) {
@@ -25,8 +25,12 @@
 
 class QDjangoMetaModel;
 class QDjangoQuery;
+class QDjangoQuerySetPrivate;
 class QDjangoWherePrivate;
 
+template <class T>
+    class QDjangoQuerySet;
+
 /** \brief The QDjangoWhere class expresses an SQL constraint.
  *
  * The QDjangoWhere class is used to build SQL WHERE statements. In its
@@ -64,6 +68,8 @@ public:
     QDjangoWhere();
     QDjangoWhere(const QDjangoWhere &other);
     QDjangoWhere(const QString &key, QDjangoWhere::Operation operation, QVariant value);
+    template <class T>
+    QDjangoWhere(const QString &key, QDjangoWhere::Operation operation, const QDjangoQuerySet<T> &querySet);
     ~QDjangoWhere();
 
     QDjangoWhere& operator=(const QDjangoWhere &other);
@@ -74,12 +80,16 @@ public:
     void bindValues(QDjangoQuery &query) const;
     bool isAll() const;
     bool isNone() const;
+    QDjangoWhere simplified() const;
     QString sql(const QSqlDatabase &db) const;
     QString toString() const;
 
 private:
+    void setSubQuery(const QString &key, QDjangoWhere::Operation operation, const QDjangoQuerySetPrivate *querySet);
+
     QSharedDataPointer<QDjangoWherePrivate> d;
     friend class QDjangoCompiler;
+    friend class QDjangoWherePrivate;
 };
 
 #endif
@@ -26,9 +26,36 @@
 //
 
 #include <QSharedData>
+#include <QSharedPointer>
+#include <QStringList>
 
+#include "QDjango_p.h"
 #include "QDjangoWhere.h"
 
+/** \internal
+ *
+ *  The QDjangoSubQuery class holds a queryset whose primary keys are the
+ *  values of an IsIn operation.
+ */
+class QDjangoSubQuery
+{
+public:
+    QDjangoSubQuery()
+        : lowMark(0)
+        , highMark(0)
+    {
+    }
+
+    QByteArray modelName;
+    QDjangoWhere where;
+    QStringList orderBy;
+    int lowMark;
+    int highMark;
+
+    // the compiled SELECT, set by QDjangoCompiler::resolve()
+    QString sql;
+};
+
 class QDjangoWherePrivate : public QSharedData
 {
 public:
@@ -42,6 +69,12 @@ public:
     };
     static QString combineToString(Combine combine);
 
+    static bool isEqual(const QDjangoWhere &a, const QDjangoWhere &b);
+    static bool isImpossible(const QList<QDjangoWhere> &children);
+    static QList<QDjangoWhere> mergeEquals(const QList<QDjangoWhere> &children);
+    static bool valueList(const QDjangoWhere &where, QVariantList *values);
+    static void appendSql(const QDjangoWhere &where, QDjangoSqlBuilder &sql, const QSqlDatabase &db, QDjangoDatabase::DatabaseType databaseType);
+
     QDjangoWherePrivate();
 
     QString key;
@@ -51,6 +84,8 @@ public:
     QList<QDjangoWhere> children;
     Combine combine;
     bool negate;
+
+    QSharedPointer<QDjangoSubQuery> subQuery;
 };
 
 #endif
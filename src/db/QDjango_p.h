@@ -21,9 +21,11 @@
 #include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QSharedPointer>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QStringList>
 #include <QVariant>
 
 #if defined(QDJANGO_SHARED)
@@ -61,6 +63,10 @@ public:
     };
 
     static DatabaseType databaseType(const QSqlDatabase &db);
+    static bool hasJsonSupport(const QSqlDatabase &db);
+    static void setJsonSupport(bool supported);
+    static bool hasWindowSupport(const QSqlDatabase &db);
+    static QString inlineValues(const QSqlDatabase &db, const QString &sql, const QVariantList &values);
 
     QSqlDatabase reference;
     QMutex mutex;
@@ -71,13 +77,110 @@ private slots:
     void threadFinished();
 };
 
+/** \brief The QDjangoSqlBuilder class accumulates an SQL statement.
+ *
+ *  The statement is appended to a single buffer which is reserved up
+ *  front, which avoids the temporaries created by QString::arg() and
+ *  QStringList::join().
+ *
+ * \internal
+ */
+class QDjangoSqlBuilder
+{
+public:
+    explicit QDjangoSqlBuilder(int capacity = 256)
+    {
+        m_sql.reserve(capacity);
+    }
+
+    QDjangoSqlBuilder &operator<<(const QString &str)
+    {
+        m_sql += str;
+        return *this;
+    }
+
+    QDjangoSqlBuilder &operator<<(const QLatin1String &str)
+    {
+        m_sql += str;
+        return *this;
+    }
+
+    QDjangoSqlBuilder &operator<<(QLatin1Char c)
+    {
+        m_sql += c;
+        return *this;
+    }
+
+    QDjangoSqlBuilder &operator<<(int value)
+    {
+        m_sql += QString::number(value);
+        return *this;
+    }
+
+    void appendJoined(const QStringList &list, const QLatin1String &separator)
+    {
+        for (int i = 0; i < list.size(); ++i) {
+            if (i)
+                m_sql += separator;
+            m_sql += list.at(i);
+        }
+    }
+
+    bool isEmpty() const
+    {
+        return m_sql.isEmpty();
+    }
+
+    int size() const
+    {
+        return m_sql.size();
+    }
+
+    QString sql() const
+    {
+        return m_sql;
+    }
+
+private:
+    QString m_sql;
+};
+
+/** \brief The QDjangoCountCache class holds the results of recent COUNT
+ *  queries.
+ *
+ * \internal
+ */
+class QDJANGO_EXPORT QDjangoCountCache
+{
+public:
+    static bool isEnabled();
+    static void clear();
+    static void invalidate(const QString &sql);
+    static bool find(const QString &key, int *count);
+    static void insert(const QString &key, int count);
+};
+
+class QDjangoQueryTrace;
+
 class QDJANGO_EXPORT QDjangoQuery : public QSqlQuery
 {
 public:
     QDjangoQuery(QSqlDatabase db);
     void addBindValue(const QVariant &val, QSql::ParamType paramType = QSql::In);
+    void addBindValues(const QVariantList &values, QSql::ParamType paramType = QSql::In);
     bool exec();
     bool exec(const QString &query);
+    bool execBatch(BatchExecutionMode mode = ValuesAsRows);
+    bool next();
+    bool prepare(const QString &query);
+
+private:
+    void trace(const QString &sql, bool ok, qint64 elapsed);
+
+    // only allocated when query observers are installed, and shared
+    // between copies so the statement is reported once
+    QSharedPointer<QDjangoQueryTrace> m_trace;
+    QString m_connectionName;
 };
 
 #endif
@@ -11,17 +11,27 @@ win32 {
 HEADERS += \
     QDjango.h \
     QDjango_p.h \
+    QDjangoIndexAdvisor.h \
     QDjangoMetaModel.h \
     QDjangoModel.h \
+    QDjangoModelArena.h \
+    QDjangoModelDescriptor.h \
+    QDjangoQueryBudget.h \
+    QDjangoQueryObserver.h \
     QDjangoQuerySet.h \
     QDjangoQuerySet_p.h \
+    QDjangoSlowQueryLog.h \
     QDjangoWhere.h \
     QDjangoWhere_p.h
 SOURCES += \
     QDjango.cpp \
+    QDjangoIndexAdvisor.cpp \
     QDjangoMetaModel.cpp \
     QDjangoModel.cpp \
+    QDjangoModelArena.cpp \
+    QDjangoQueryBudget.cpp \
     QDjangoQuerySet.cpp \
+    QDjangoSlowQueryLog.cpp \
     QDjangoWhere.cpp
 
 # Installation
@@ -0,0 +1,4 @@
+include(../bench.pri)
+
+TARGET = bench_arena
+SOURCES += bench_arena.cpp
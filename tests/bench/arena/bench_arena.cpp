@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include "QDjango.h"
+#include "QDjangoModelArena.h"
+#include "QDjangoQuerySet.h"
+
+#include "auth-models.h"
+#include "util.h"
+
+// count every heap allocation made by the process
+
+static QAtomicInt allocationCount(0);
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    allocationCount.ref();
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+static int allocations()
+{
+    return allocationCount.fetchAndAddRelaxed(0);
+}
+
+static const int ROW_COUNT = 1000;
+
+/** Compares loading models one by one on the heap with loading them into
+ *  a QDjangoModelArena.
+ */
+class bench_Arena : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void allocationsPerRow();
+    void loadHeap();
+    void loadArena();
+    void cleanupTestCase();
+
+private:
+    int loadHeapOnce();
+    int loadArenaOnce();
+};
+
+void bench_Arena::initTestCase()
+{
+    QVERIFY(initialiseDatabase());
+    QDjango::registerModel<User>();
+    QVERIFY(QDjango::createTables());
+
+    QList<User*> users;
+    for (int i = 0; i < ROW_COUNT; ++i) {
+        User *user = new User;
+        user->setUsername(QString::fromLatin1("user%1").arg(i));
+        user->setPassword(QLatin1String("password"));
+        users << user;
+    }
+    QVERIFY(QDjangoQuerySet<User>().bulkInsert(users));
+    qDeleteAll(users);
+}
+
+/** Reports the number of heap allocations for each way of loading the
+ *  whole table.
+ */
+void bench_Arena::allocationsPerRow()
+{
+    int before = allocations();
+    QCOMPARE(loadHeapOnce(), ROW_COUNT);
+    const int heap = allocations() - before;
+
+    before = allocations();
+    QCOMPARE(loadArenaOnce(), ROW_COUNT);
+    const int arena = allocations() - before;
+
+    qDebug("heap: %d allocations (%.1f per row)", heap, qreal(heap) / ROW_COUNT);
+    qDebug("arena: %d allocations (%.1f per row)", arena, qreal(arena) / ROW_COUNT);
+    QVERIFY(arena < heap);
+}
+
+void bench_Arena::loadHeap()
+{
+    QBENCHMARK {
+        loadHeapOnce();
+    }
+}
+
+void bench_Arena::loadArena()
+{
+    QBENCHMARK {
+        loadArenaOnce();
+    }
+}
+
+void bench_Arena::cleanupTestCase()
+{
+    QDjango::dropTables();
+}
+
+int bench_Arena::loadHeapOnce()
+{
+    QDjangoQuerySet<User> qs;
+    QList<User*> users;
+    const int size = qs.size();
+    for (int i = 0; i < size; ++i)
+        users << qs.at(i);
+    const int count = users.size();
+    qDeleteAll(users);
+    return count;
+}
+
+int bench_Arena::loadArenaOnce()
+{
+    QDjangoModelArena arena;
+    QList<User*> users;
+    QDjangoQuerySet<User>().fetch(arena, &users);
+    return users.size();
+}
+
+QTEST_MAIN(bench_Arena)
+#include "bench_arena.moc"
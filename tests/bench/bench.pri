@@ -0,0 +1,7 @@
+include(../db/db.pri)
+
+# benchmarks are run explicitly, not as part of "make check"
+CONFIG -= testcase
+
+HEADERS += $$PWD/../db/auth-models.h
+SOURCES += $$PWD/../db/auth-models.cpp
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2010-2014 Jeremy Lainé
+ * Contact: https://github.com/jlaine/qdjango
+ *
+ * This file is part of the QDjango Library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include <QDir>
+
+#include "QDjango.h"
+#include "QDjangoQuerySet.h"
+#include "QDjangoQuerySet_p.h"
+#include "QDjangoWhere.h"
+
+#include "auth-models.h"
+
+static const int ROW_COUNT = 1000;
+
+/** Measures the cost of the main ORM operations over the auth models,
+ *  on an in-memory and on a file-backed SQLite database.
+ *
+ *  Each benchmark has one row per database. Results can be written in
+ *  a machine-readable format using the QtTest loggers, for instance:
+ *
+ *  \code
+ *  ./bench_orm -csv > results.csv
+ *  ./bench_orm -xml > results.xml
+ *  \endcode
+ */
+class bench_Orm : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void compile_data();
+    void compile();
+    void get_data();
+    void get();
+    void save_data();
+    void save();
+    void bulkInsert_data();
+    void bulkInsert();
+    void load_data();
+    void load();
+    void iterate_data();
+    void iterate();
+    void selectRelated_data();
+    void selectRelated();
+    void values_data();
+    void values();
+    void count_data();
+    void count();
+    void cleanupTestCase();
+
+private:
+    void addDatabases();
+    bool loadFixtures();
+    void useDatabase();
+
+    QString m_fileName;
+};
+
+void bench_Orm::initTestCase()
+{
+    QDjango::registerModel<User>();
+    QDjango::registerModel<Group>();
+    QDjango::registerModel<UserGroups>();
+    QDjango::registerModel<Message>();
+
+    QSqlDatabase memory = QSqlDatabase::addDatabase("QSQLITE", "memory");
+    memory.setDatabaseName(":memory:");
+    QVERIFY(memory.open());
+
+    m_fileName = QDir::temp().filePath("bench_orm.sqlite");
+    QFile::remove(m_fileName);
+    QSqlDatabase file = QSqlDatabase::addDatabase("QSQLITE", "file");
+    file.setDatabaseName(m_fileName);
+    QVERIFY(file.open());
+
+    QDjango::setDatabase(memory);
+    QVERIFY(QDjango::createTables());
+    QVERIFY(loadFixtures());
+
+    QDjango::setDatabase(file);
+    QVERIFY(QDjango::createTables());
+    QVERIFY(loadFixtures());
+}
+
+/** Compiles a SELECT with a filter, an ordering and a join, without
+ *  executing it.
+ */
+void bench_Orm::compile_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::compile()
+{
+    useDatabase();
+    QBENCHMARK {
+        QDjangoQuerySetPrivate qs("Message");
+        qs.addFilter(QDjangoWhere("user__username", QDjangoWhere::StartsWith, "user"));
+        qs.orderBy << "-id";
+        qs.selectRelated = true;
+        qs.selectQuery();
+    }
+}
+
+void bench_Orm::get_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::get()
+{
+    useDatabase();
+    const QDjangoQuerySet<User> users;
+    User user;
+    QBENCHMARK {
+        users.get(QDjangoWhere("username", QDjangoWhere::Equals, "user500"), &user);
+    }
+    QCOMPARE(user.username(), QLatin1String("user500"));
+}
+
+/** Saves an existing object, which checks for its existence then
+ *  updates it.
+ */
+void bench_Orm::save_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::save()
+{
+    useDatabase();
+    User user;
+    QVERIFY(QDjangoQuerySet<User>().get(QDjangoWhere("username", QDjangoWhere::Equals, "user500"), &user));
+    QBENCHMARK {
+        user.save();
+    }
+}
+
+/** Inserts then removes 100 groups.
+ */
+void bench_Orm::bulkInsert_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::bulkInsert()
+{
+    useDatabase();
+    QList<Group*> groups;
+    for (int i = 0; i < 100; ++i) {
+        Group *group = new Group;
+        group->setName(QString::fromLatin1("group%1").arg(i));
+        groups << group;
+    }
+
+    QDjangoQuerySet<Group> qs;
+    QBENCHMARK {
+        qs.bulkInsert(groups);
+        qs.remove();
+    }
+    qDeleteAll(groups);
+}
+
+/** Loads all the users into a list.
+ */
+void bench_Orm::load_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::load()
+{
+    useDatabase();
+    QBENCHMARK {
+        QDjangoQuerySet<User> qs;
+        QList<User*> users;
+        const int size = qs.size();
+        for (int i = 0; i < size; ++i)
+            users << qs.at(i);
+        qDeleteAll(users);
+    }
+}
+
+/** Iterates over all the users, without keeping them.
+ */
+void bench_Orm::iterate_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::iterate()
+{
+    useDatabase();
+    int count = 0;
+    QBENCHMARK {
+        const QDjangoQuerySet<User> qs;
+        count = 0;
+        QDjangoQuerySet<User>::const_iterator it;
+        for (it = qs.constBegin(); it != qs.constEnd(); ++it)
+            count++;
+    }
+    QCOMPARE(count, ROW_COUNT);
+}
+
+/** Loads all the messages along with their user.
+ */
+void bench_Orm::selectRelated_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::selectRelated()
+{
+    useDatabase();
+    QBENCHMARK {
+        QDjangoQuerySet<Message> qs = QDjangoQuerySet<Message>().selectRelated();
+        const int size = qs.size();
+        for (int i = 0; i < size; ++i) {
+            Message *message = qs.at(i);
+            message->user();
+            delete message;
+        }
+    }
+}
+
+void bench_Orm::values_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::values()
+{
+    useDatabase();
+    QList<QVariantMap> values;
+    QBENCHMARK {
+        QDjangoQuerySet<User> qs;
+        values = qs.values(QStringList() << "username" << "email");
+    }
+    QCOMPARE(values.size(), ROW_COUNT);
+}
+
+void bench_Orm::count_data()
+{
+    addDatabases();
+}
+
+void bench_Orm::count()
+{
+    useDatabase();
+    const QDjangoQuerySet<User> qs = QDjangoQuerySet<User>().filter(
+        QDjangoWhere("username", QDjangoWhere::StartsWith, "user"));
+    int count = 0;
+    QBENCHMARK {
+        count = qs.count();
+    }
+    QCOMPARE(count, ROW_COUNT);
+}
+
+void bench_Orm::cleanupTestCase()
+{
+    QDjango::setDatabase(QSqlDatabase::database("memory"));
+    QDjango::dropTables();
+    QDjango::setDatabase(QSqlDatabase::database("file"));
+    QDjango::dropTables();
+    QFile::remove(m_fileName);
+}
+
+void bench_Orm::addDatabases()
+{
+    QTest::addColumn<QString>("connection");
+    QTest::newRow("memory") << "memory";
+    QTest::newRow("file") << "file";
+}
+
+/** Creates ROW_COUNT users with one message each.
+ */
+bool bench_Orm::loadFixtures()
+{
+    QList<User*> users;
+    for (int i = 0; i < ROW_COUNT; ++i) {
+        User *user = new User;
+        user->setUsername(QString::fromLatin1("user%1").arg(i));
+        user->setPassword(QLatin1String("password"));
+        users << user;
+    }
+    const bool ok = QDjangoQuerySet<User>().bulkInsert(users);
+    qDeleteAll(users);
+    if (!ok)
+        return false;
+
+    QDjangoQuerySet<User> qs;
+    QList<Message*> messages;
+    for (int i = 0; i < qs.size(); ++i) {
+        User *user = qs.at(i);
+        Message *message = new Message;
+        message->setUser(user);
+        message->setMessage(QLatin1String("hello ") + user->username());
+        messages << message;
+        user->setParent(message);
+    }
+    const bool messagesOk = QDjangoQuerySet<Message>().bulkInsert(messages);
+    qDeleteAll(messages);
+    return messagesOk;
+}
+
+void bench_Orm::useDatabase()
+{
+    QFETCH(QString, connection);
+    QDjango::setDatabase(QSqlDatabase::database(connection));
+}
+
+QTEST_MAIN(bench_Orm)
+#include "bench_orm.moc"
@@ -0,0 +1,4 @@
+include(../bench.pri)
+
+TARGET = bench_orm
+SOURCES += bench_orm.cpp
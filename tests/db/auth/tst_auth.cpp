@@ -15,12 +15,59 @@
  * Lesser General Public License for more details.
  */
 
+#include "QDjangoIndexAdvisor.h"
+#include "QDjangoModelArena.h"
+#include "QDjangoQueryBudget.h"
 #include "QDjangoQuerySet.h"
 #include "QDjangoWhere.h"
 
 #include "auth-models.h"
 #include "util.h"
 
+/** Collects the usernames passed to it, possibly from several threads.
+ */
+class UsernameCollector
+{
+public:
+    UsernameCollector(QMutex *mutex, QStringList *usernames)
+        : m_mutex(mutex)
+        , m_usernames(usernames)
+    {
+    }
+
+    void operator()(const User &user)
+    {
+        QMutexLocker locker(m_mutex);
+        m_usernames->append(user.username());
+    }
+
+private:
+    QMutex *m_mutex;
+    QStringList *m_usernames;
+};
+
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+/** Collects the usernames of active users from (username, is_active) tuples.
+ */
+class TupleCollector
+{
+public:
+    TupleCollector(QStringList *usernames)
+        : m_usernames(usernames)
+    {
+    }
+
+    void operator()(const std::tuple<QString, bool> &row)
+    {
+        if (std::get<1>(row))
+            m_usernames->append(std::get<0>(row));
+    }
+
+private:
+    QStringList *m_usernames;
+};
+#endif
+
 /** Tests for the User class.
  */
 class tst_Auth: public QObject
@@ -33,7 +80,12 @@ private slots:
     void remove();
     void removeFilter();
     void removeLimit();
+    void bulkInsert();
+    void bulkRemove();
     void get();
+    void estimatedCount();
+    void totalCount();
+    void countCache();
     void filter();
     void filterLike();
     void exclude();
@@ -43,10 +95,17 @@ private slots:
     void update();
     void values();
     void valuesList();
+    void valuesTuple();
     void constIterator();
+    void forEach();
+    void fetch();
+    void parallelForEach();
     void testGroups();
     void testRelated();
+    void queryBudget();
+    void indexAdvisor();
     void filterRelated();
+    void filterSubQuery();
     void cleanup();
     void cleanupTestCase();
 
@@ -207,6 +266,186 @@ void tst_Auth::removeLimit()
     QCOMPARE(users.all().size(), 3);
 }
 
+/** Test inserting multiple users in a batch.
+ */
+void tst_Auth::bulkInsert()
+{
+    QList<User*> objects;
+    for (int i = 0; i < 3; ++i) {
+        User *user = new User;
+        user->setUsername(QString::fromLatin1("user%1").arg(i));
+        user->setPassword(QString::fromLatin1("pass%1").arg(i));
+        user->setLastLogin(QDateTime(QDate(2010, 6, 1), QTime(10, i, 0)));
+        objects << user;
+    }
+
+    QDjangoQuerySet<User> users;
+    QCOMPARE(users.bulkInsert(objects), true);
+    qDeleteAll(objects);
+
+    QDjangoQuerySet<User> qs = users.orderBy(QStringList("username"));
+    QCOMPARE(qs.size(), 3);
+    User *other = qs.at(2);
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("user2"));
+    QCOMPARE(other->password(), QLatin1String("pass2"));
+    QCOMPARE(other->lastLogin(), QDateTime(QDate(2010, 6, 1), QTime(10, 2, 0)));
+    delete other;
+
+    // inserting nothing succeeds
+    QCOMPARE(users.bulkInsert(QList<User*>()), true);
+}
+
+/** Test removing multiple users in a batch.
+ */
+void tst_Auth::bulkRemove()
+{
+    loadFixtures();
+
+    QDjangoQuerySet<User> users;
+    QList<User*> objects;
+    objects << users.get(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    objects << users.get(QDjangoWhere("username", QDjangoWhere::Equals, "wizuser"));
+    QVERIFY(objects[0] != 0);
+    QVERIFY(objects[1] != 0);
+    QCOMPARE(users.bulkRemove(objects), true);
+    qDeleteAll(objects);
+
+    // check remaining user
+    QDjangoQuerySet<User> qs = users.all();
+    QCOMPARE(qs.size(), 1);
+    User *other = qs.at(0);
+    QVERIFY(other != 0);
+    QCOMPARE(other->username(), QLatin1String("baruser"));
+    delete other;
+}
+
+/** Estimate the number of objects from the database statistics.
+ */
+void tst_Auth::estimatedCount()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    const QDjangoQuerySet<User> filtered = users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+
+    // below the threshold, an exact count is made
+    QCOMPARE(users.estimatedCount(), 3);
+    QCOMPARE(filtered.estimatedCount(), 1);
+    QCOMPARE(users.filter(QDjangoWhere("pk", QDjangoWhere::IsNull, true)).estimatedCount(), 0);
+    QCOMPARE(users.none().estimatedCount(), 0);
+
+    // once the statistics are up to date, they are used
+    QSqlDatabase db = QDjango::database();
+    const QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    if (databaseType == QDjangoDatabase::SQLite || databaseType == QDjangoDatabase::PostgreSQL) {
+        QDjangoQuery query(db);
+        QVERIFY(query.exec("ANALYZE"));
+        QCOMPARE(users.estimatedCount(0), 3);
+        QCOMPARE(users.limit(0, 2).estimatedCount(0), users.limit(0, 2).count());
+    }
+    if (databaseType == QDjangoDatabase::SQLite)
+        QCOMPARE(filtered.estimatedCount(0), 1);
+
+    // filtered sets use the planner's estimate rather than a COUNT
+    if (databaseType == QDjangoDatabase::PostgreSQL) {
+        QDjangoQueryBudget budget;
+        QCOMPARE(filtered.estimatedCount(0), 1);
+        QCOMPARE(budget.queryCount(), 1);
+        QVERIFY(budget.counts().keys().first().startsWith("EXPLAIN "));
+    }
+}
+
+/** Fetch a page and the total number of objects.
+ */
+void tst_Auth::totalCount()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users = QDjangoQuerySet<User>().orderBy(QStringList("username"));
+    QCOMPARE(users.none().totalCount(), 0);
+
+    // unsliced
+    QDjangoQuerySet<User> qs = users;
+    QCOMPARE(qs.totalCount(), 3);
+
+    // first page
+    {
+        QDjangoQueryBudget budget;
+        qs = users.limit(0, 2);
+        QCOMPARE(qs.totalCount(), 3);
+        QCOMPARE(qs.size(), 2);
+        User user;
+        QVERIFY(qs.at(1, &user));
+        QCOMPARE(user.username(), QLatin1String("foouser"));
+        if (QDjangoDatabase::hasWindowSupport(QDjango::database()))
+            QCOMPARE(budget.queryCount(), 1);
+        else
+            QCOMPARE(budget.queryCount(), 2);
+    }
+
+    // last page
+    qs = users.limit(2, 2);
+    QCOMPARE(qs.totalCount(), 3);
+    QCOMPARE(qs.size(), 1);
+
+    // past the end
+    qs = users.limit(4, 2);
+    QCOMPARE(qs.totalCount(), 3);
+    QCOMPARE(qs.size(), 0);
+}
+
+/** Cache the results of COUNT queries.
+ */
+void tst_Auth::countCache()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    const QDjangoQuerySet<User> filtered = users.filter(QDjangoWhere("username", QDjangoWhere::StartsWith, "foo"));
+
+    QCOMPARE(QDjango::countCacheTimeout(), 0);
+    QDjango::setCountCacheTimeout(60000);
+    QCOMPARE(QDjango::countCacheTimeout(), 60000);
+
+    {
+        QDjangoQueryBudget budget;
+        QCOMPARE(users.count(), 3);
+        QCOMPARE(users.count(), 3);
+        QCOMPARE(filtered.count(), 1);
+        QCOMPARE(users.filter(QDjangoWhere("username", QDjangoWhere::StartsWith, "foo")).count(), 1);
+        QCOMPARE(budget.queryCount(), 2);
+    }
+
+    // values differing by milliseconds are cached separately
+    const QDateTime login(QDate(2010, 6, 1), QTime(10, 5, 14));
+    QCOMPARE(users.filter(QDjangoWhere("last_login", QDjangoWhere::LessThan, login.addMSecs(500))).count(), 1);
+    QCOMPARE(users.filter(QDjangoWhere("last_login", QDjangoWhere::LessThan, login)).count(), 0);
+
+    // writes to other tables keep the cache
+    {
+        Group group;
+        group.setName("foogroup");
+        QCOMPARE(group.save(), true);
+
+        QDjangoQueryBudget budget;
+        QCOMPARE(users.count(), 3);
+        QCOMPARE(filtered.count(), 1);
+        QCOMPARE(budget.queryCount(), 0);
+    }
+
+    // writes to the table drop its counts
+    User user;
+    user.setUsername("foouser2");
+    user.setPassword("foopass2");
+    QCOMPARE(user.save(), true);
+    QCOMPARE(users.count(), 4);
+    QCOMPARE(filtered.count(), 2);
+
+    QDjango::setCountCacheTimeout(0);
+    QCOMPARE(QDjango::countCacheTimeout(), 0);
+}
+
 /** Test retrieving a single user.
  */
 void tst_Auth::get()
@@ -270,8 +509,27 @@ void tst_Auth::filter()
     // two tests on username
     qs = users.filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser") ||
                       QDjangoWhere("username", QDjangoWhere::Equals, "baruser"));
-    CHECKWHERE(qs.where(), QLatin1String("\"user\".\"username\" = ? OR \"user\".\"username\" = ?"), QVariantList() << "foouser" << "baruser");
+    CHECKWHERE(qs.where(), QLatin1String("\"user\".\"username\" IN (?, ?)"), QVariantList() << "foouser" << "baruser");
     QCOMPARE(qs.size(), 2);
+
+    // username in a list longer than the bound values SQLite accepts
+    QVariantList usernames;
+    usernames << "foouser" << "it's";
+    for (int i = 0; i < 2000; ++i)
+        usernames << QString::fromLatin1("user%1").arg(i);
+    qs = users.filter(QDjangoWhere("username", QDjangoWhere::IsIn, usernames));
+    QCOMPARE(qs.size(), 1);
+
+    QSqlDatabase db = QDjango::database();
+    if (QDjangoDatabase::databaseType(db) == QDjangoDatabase::SQLite) {
+        const bool hasJson = QDjangoDatabase::hasJsonSupport(db);
+        QDjangoDatabase::setJsonSupport(false);
+        qs = users.filter(QDjangoWhere("username", QDjangoWhere::IsIn, usernames));
+        QCOMPARE(qs.size(), 1);
+        qs = users.exclude(QDjangoWhere("username", QDjangoWhere::IsIn, usernames));
+        QCOMPARE(qs.size(), 2);
+        QDjangoDatabase::setJsonSupport(hasJson);
+    }
 }
 
 /** Test filtering users with a "like" condition.
@@ -539,6 +797,40 @@ void tst_Auth::values()
     QCOMPARE(map[2]["password"], QVariant("wizpass"));
 }
 
+/** Test retrieving typed tuples of values.
+ */
+void tst_Auth::valuesTuple()
+{
+#ifdef Q_COMPILER_VARIADIC_TEMPLATES
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+
+    std::vector<std::tuple<QString, QString> > list = users.all().valuesTuple<QString, QString>(QStringList() << "username" << "password");
+    QCOMPARE(int(list.size()), 3);
+    QCOMPARE(std::get<0>(list[0]), QString("foouser"));
+    QCOMPARE(std::get<1>(list[0]), QString("foopass"));
+    QCOMPARE(std::get<0>(list[1]), QString("baruser"));
+    QCOMPARE(std::get<1>(list[1]), QString("barpass"));
+    QCOMPARE(std::get<0>(list[2]), QString("wizuser"));
+    QCOMPARE(std::get<1>(list[2]), QString("wizpass"));
+
+    list = users.none().valuesTuple<QString, QString>(QStringList() << "username" << "password");
+    QCOMPARE(int(list.size()), 0);
+
+    QStringList usernames;
+    QVERIFY(users.filter(QDjangoWhere("is_active", QDjangoWhere::Equals, true)).valuesTuple<QString, bool>(
+        QStringList() << "username" << "is_active", TupleCollector(&usernames)));
+    QCOMPARE(usernames, QStringList() << "foouser" << "baruser" << "wizuser");
+#else
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+    QSKIP("Variadic templates are not supported");
+#else
+    QSKIP("Variadic templates are not supported", SkipAll);
+#endif
+#endif
+}
+
 /** Test retrieving lists of values.
  */
 void tst_Auth::valuesList()
@@ -640,11 +932,107 @@ void tst_Auth::constIterator()
     QCOMPARE(int(last - it), 3);
 }
 
+/** Test streaming the objects of a set.
+ */
+void tst_Auth::forEach()
+{
+    loadFixtures();
+
+    QMutex mutex;
+    QStringList usernames;
+    const QDjangoQuerySet<User> users = QDjangoQuerySet<User>().orderBy(QStringList("username"));
+
+    // batches smaller than the set
+    QCOMPARE(users.forEach(UsernameCollector(&mutex, &usernames), 2), true);
+    QCOMPARE(usernames, QStringList() << "baruser" << "foouser" << "wizuser");
+
+    // batch size equal to the set
+    usernames.clear();
+    QCOMPARE(users.forEach(UsernameCollector(&mutex, &usernames), 3), true);
+    QCOMPARE(usernames, QStringList() << "baruser" << "foouser" << "wizuser");
+
+    // filtered set
+    usernames.clear();
+    QCOMPARE(users.filter(QDjangoWhere("username", QDjangoWhere::StartsWith, "w"))
+                 .forEach(UsernameCollector(&mutex, &usernames)), true);
+    QCOMPARE(usernames, QStringList() << "wizuser");
+
+    // empty set
+    usernames.clear();
+    QCOMPARE(users.none().forEach(UsernameCollector(&mutex, &usernames)), true);
+    QCOMPARE(usernames, QStringList());
+
+    // the caller's transaction is left open
+    QSqlDatabase db = QDjango::database();
+    QVERIFY(db.transaction());
+    User other;
+    other.setUsername("zzzuser");
+    other.setPassword("zzzpass");
+    QCOMPARE(other.save(), true);
+    usernames.clear();
+    QCOMPARE(users.forEach(UsernameCollector(&mutex, &usernames), 2), true);
+    QCOMPARE(usernames, QStringList() << "baruser" << "foouser" << "wizuser" << "zzzuser");
+    QVERIFY(db.rollback());
+    QCOMPARE(QDjangoQuerySet<User>().count(), 3);
+}
+
+/** Test loading objects into an arena.
+ */
+void tst_Auth::fetch()
+{
+    loadFixtures();
+
+    QDjangoModelArena arena;
+    QList<User*> users;
+    QVERIFY(QDjangoQuerySet<User>().orderBy(QStringList() << "username").fetch(arena, &users));
+    QCOMPARE(users.size(), 3);
+    QCOMPARE(users[0]->username(), QLatin1String("baruser"));
+    QCOMPARE(users[1]->username(), QLatin1String("foouser"));
+    QCOMPARE(users[2]->username(), QLatin1String("wizuser"));
+    QCOMPARE(arena.size(), 3);
+
+    // an empty set appends nothing
+    QVERIFY(QDjangoQuerySet<User>().none().fetch(arena, &users));
+    QCOMPARE(users.size(), 3);
+    QCOMPARE(arena.size(), 3);
+
+    arena.clear();
+    QCOMPARE(arena.size(), 0);
+}
+
+/** Test evaluating a set concurrently.
+ */
+void tst_Auth::parallelForEach()
+{
+    loadFixtures();
+
+    QMutex mutex;
+    QStringList usernames;
+    const QDjangoQuerySet<User> users;
+    QCOMPARE(users.parallelForEach(UsernameCollector(&mutex, &usernames), 2), true);
+    usernames.sort();
+    QCOMPARE(usernames, QStringList() << "baruser" << "foouser" << "wizuser");
+
+    // filtered set
+    usernames.clear();
+    QCOMPARE(users.exclude(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"))
+                 .parallelForEach(UsernameCollector(&mutex, &usernames), 4), true);
+    usernames.sort();
+    QCOMPARE(usernames, QStringList() << "baruser" << "wizuser");
+
+    // empty set
+    usernames.clear();
+    QCOMPARE(users.none().parallelForEach(UsernameCollector(&mutex, &usernames)), true);
+    QCOMPARE(usernames, QStringList());
+}
 
 /** Clear database table after each test.
  */
 void tst_Auth::cleanup()
 {
+    // a failed countCache() test would leave the cache enabled
+    QDjango::setCountCacheTimeout(0);
+
     QCOMPARE(QDjangoQuerySet<UserGroups>().remove(), true);
     QCOMPARE(QDjangoQuerySet<Message>().remove(), true);
     QCOMPARE(QDjangoQuerySet<Group>().remove(), true);
@@ -707,6 +1095,94 @@ void tst_Auth::testRelated()
     delete cached;
 }
 
+/** Detect lazy loading of related models inside a loop.
+ */
+void tst_Auth::queryBudget()
+{
+    loadFixtures();
+    QDjangoQuerySet<User> users;
+    for (int i = 0; i < users.size(); ++i) {
+        User *user = users.at(i);
+        Message *message = new Message;
+        message->setUser(user);
+        message->setMessage("hello " + user->username());
+        QCOMPARE(message->save(), true);
+        delete message;
+        delete user;
+    }
+
+    // one SQL query for the messages, then one per user
+    {
+        QDjangoQueryBudget budget(1);
+        QDjangoQuerySet<Message> messages;
+        QCOMPARE(messages.size(), 3);
+        for (int i = 0; i < messages.size(); ++i) {
+            Message *message = messages.at(i);
+            QVERIFY(message->user() != 0);
+            delete message;
+        }
+        QCOMPARE(budget.queryCount(), 4);
+        QCOMPARE(budget.counts().size(), 2);
+        QCOMPARE(budget.repeatedQueries().size(), 1);
+        QCOMPARE(budget.isExceeded(), true);
+    }
+
+    // a single SQL query
+    {
+        QDjangoQueryBudget budget(1, 1);
+        QDjangoQuerySet<Message> messages = QDjangoQuerySet<Message>().selectRelated();
+        QCOMPARE(messages.size(), 3);
+        for (int i = 0; i < messages.size(); ++i) {
+            Message *message = messages.at(i);
+            QVERIFY(message->user() != 0);
+            delete message;
+        }
+        QCOMPARE(budget.queryCount(), 1);
+        QCOMPARE(budget.isExceeded(), false);
+    }
+}
+
+/** Suggest indexes from the executed queries.
+ */
+void tst_Auth::indexAdvisor()
+{
+    loadFixtures();
+    User *foo = QDjangoQuerySet<User>().get(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"));
+    QVERIFY(foo != 0);
+
+    QDjangoIndexAdvisor advisor;
+    QDjango::addQueryObserver(&advisor);
+    for (int i = 0; i < 3; ++i) {
+        QDjangoQuerySet<User> users = QDjangoQuerySet<User>()
+            .filter(QDjangoWhere("username", QDjangoWhere::Equals, "foouser"))
+            .orderBy(QStringList("-date_joined"));
+        QCOMPARE(users.size(), 1);
+    }
+    QDjangoQuerySet<User> users = QDjangoQuerySet<User>()
+        .filter(QDjangoWhere("pk", QDjangoWhere::Equals, foo->pk()));
+    QCOMPARE(users.size(), 1);
+    delete foo;
+    QDjango::removeQueryObserver(&advisor);
+
+    // the primary key is already indexed
+    QList<QDjangoIndexAdvisor::Suggestion> suggestions = advisor.suggestions();
+    QCOMPARE(suggestions.size(), 1);
+    QCOMPARE(suggestions[0].table, QLatin1String("user"));
+    QCOMPARE(suggestions[0].columns, QStringList() << "username" << "-date_joined");
+    QCOMPARE(suggestions[0].count, 3);
+    QVERIFY(suggestions[0].sql.startsWith("CREATE INDEX "));
+    QVERIFY(suggestions[0].sql.contains(QDjangoMetaModel::indexName("user", suggestions[0].columns)));
+
+    // the database reports the new index
+    QDjangoQuery query(QDjango::database());
+    QVERIFY(query.exec(suggestions[0].sql));
+    QCOMPARE(advisor.suggestions().size(), 0);
+    QCOMPARE(advisor.suggestions(false).size(), 1);
+
+    advisor.clear();
+    QCOMPARE(advisor.suggestions(false).size(), 0);
+}
+
 /** Perform filtering on a foreign field.
  */
 void tst_Auth::filterRelated()
@@ -740,6 +1216,57 @@ void tst_Auth::filterRelated()
     delete msg;
 }
 
+/** Test filtering on the primary keys of another queryset.
+ */
+void tst_Auth::filterSubQuery()
+{
+    loadFixtures();
+
+    const QDjangoQuerySet<User> users;
+    const QStringList usernames = QStringList() << "foouser" << "wizuser";
+    foreach (const QString &username, usernames) {
+        User *user = users.get(QDjangoWhere("username", QDjangoWhere::Equals, username));
+        QVERIFY(user != 0);
+        Message message;
+        message.setUser(user);
+        message.setMessage(QLatin1String("message for ") + username);
+        QCOMPARE(message.save(), true);
+        delete user;
+    }
+
+    const QDjangoQuerySet<User> fooUsers = users.filter(
+        QDjangoWhere("username", QDjangoWhere::StartsWith, "foo"));
+    QDjangoQuerySet<Message> qs = QDjangoQuerySet<Message>().filter(
+        QDjangoWhere("user_id", QDjangoWhere::IsIn, fooUsers));
+    QCOMPARE(qs.count(), 1);
+    QCOMPARE(qs.size(), 1);
+    Message *msg = qs.at(0);
+    QVERIFY(msg != 0);
+    QCOMPARE(msg->message(), QLatin1String("message for foouser"));
+    delete msg;
+
+    // negated subquery
+    qs = QDjangoQuerySet<Message>().exclude(
+        QDjangoWhere("user_id", QDjangoWhere::IsIn, fooUsers));
+    QCOMPARE(qs.size(), 1);
+    msg = qs.at(0);
+    QVERIFY(msg != 0);
+    QCOMPARE(msg->message(), QLatin1String("message for wizuser"));
+    delete msg;
+
+    // empty subquery
+    qs = QDjangoQuerySet<Message>().filter(
+        QDjangoWhere("user_id", QDjangoWhere::IsIn, users.none()));
+    QCOMPARE(qs.size(), 0);
+
+    // subqueries other than IsIn match nothing
+    QTest::ignoreMessage(QtWarningMsg, "QDjangoWhere subqueries can only be used with IsIn");
+    const QDjangoWhere invalid("user_id", QDjangoWhere::Equals, fooUsers);
+    QVERIFY(invalid.isNone());
+    qs = QDjangoQuerySet<Message>().filter(invalid);
+    QCOMPARE(qs.size(), 0);
+}
+
 /** Test many-to-many relationships using an intermediate table.
  */
 void tst_Auth::testGroups()
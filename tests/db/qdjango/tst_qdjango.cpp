@@ -15,13 +15,17 @@
  * Lesser General Public License for more details.
  */
 
+#include <QDir>
+#include <QFile>
 #include <QSqlDriver>
 #include <QThread>
 #include <QTimer>
 
 #include "QDjango.h"
 #include "QDjangoModel.h"
+#include "QDjangoQueryObserver.h"
 #include "QDjangoQuerySet.h"
+#include "QDjangoSlowQueryLog.h"
 
 #include "util.h"
 
@@ -60,6 +64,26 @@ void Worker::doIt()
     emit done();
 }
 
+class QueryRecorder : public QDjangoQueryObserver
+{
+public:
+    void queryExecuted(const QDjangoQueryEvent &event)
+    {
+        events << event;
+    }
+
+    QDjangoQueryEvent last(const QString &prefix) const
+    {
+        for (int i = events.size() - 1; i >= 0; --i) {
+            if (events[i].sql.startsWith(prefix))
+                return events[i];
+        }
+        return QDjangoQueryEvent();
+    }
+
+    QList<QDjangoQueryEvent> events;
+};
+
 class tst_QDjango : public QObject
 {
     Q_OBJECT
@@ -70,6 +94,12 @@ private slots:
     void databaseThreaded();
     void debugEnabled();
     void debugQuery();
+    void inlineValues();
+    void metaModel();
+    void queryFingerprint_data();
+    void queryFingerprint();
+    void queryObserver();
+    void slowQueryLog();
     void cleanup();
 };
 
@@ -146,5 +176,155 @@ void tst_QDjango::debugQuery()
     QDjango::setDebugEnabled(false);
 }
 
+void tst_QDjango::inlineValues()
+{
+    QSqlDatabase db = QDjango::database();
+    const QString sql = QLatin1String("SELECT '?', 'it''s?' FROM t WHERE a = ? AND \"b?\" = ?");
+    QCOMPARE(QDjangoDatabase::inlineValues(db, sql, QVariantList() << 1 << QLatin1String("x")),
+             QLatin1String("SELECT '?', 'it''s?' FROM t WHERE a = 1 AND \"b?\" = 'x'"));
+}
+
+void tst_QDjango::metaModel()
+{
+    // lookup by class
+    const QDjangoMetaModel metaModel = QDjango::metaModel<Author>();
+    QVERIFY(metaModel.isValid());
+    QCOMPARE(metaModel.table(), QLatin1String("author"));
+
+    // lookup by instance
+    Author author;
+    QCOMPARE(QDjango::metaModel(&author).table(), QLatin1String("author"));
+
+    // registering again returns the same model
+    QCOMPARE(QDjango::registerModel<Author>().table(), QLatin1String("author"));
+
+    // unregistered class
+    QVERIFY(!QDjango::metaModel<Worker>().isValid());
+}
+
+void tst_QDjango::queryFingerprint_data()
+{
+    QTest::addColumn<QString>("sql");
+    QTest::addColumn<QString>("fingerprint");
+
+    QTest::newRow("placeholder") << "SELECT a FROM t WHERE b = ?" << "SELECT a FROM t WHERE b = ?";
+    QTest::newRow("number") << "SELECT a FROM t WHERE b = 12 AND c = -3.5" << "SELECT a FROM t WHERE b = ? AND c = ?";
+    QTest::newRow("string") << "SELECT a FROM t WHERE b = 'it''s'" << "SELECT a FROM t WHERE b = ?";
+    QTest::newRow("identifier") << "SELECT t1.a FROM t1" << "SELECT t1.a FROM t1";
+    QTest::newRow("in") << "SELECT a FROM t WHERE b IN (?, ?, ?)" << "SELECT a FROM t WHERE b IN (?)";
+    QTest::newRow("rows") << "INSERT INTO t (a, b) VALUES (?, ?), (?, ?)" << "INSERT INTO t (a, b) VALUES (?)";
+}
+
+void tst_QDjango::queryFingerprint()
+{
+    QFETCH(QString, sql);
+    QFETCH(QString, fingerprint);
+
+    QCOMPARE(QDjangoQueryEvent::fingerprint(sql), fingerprint);
+}
+
+void tst_QDjango::queryObserver()
+{
+    QueryRecorder recorder;
+    QDjango::addQueryObserver(&recorder);
+
+    Author author;
+    author.setName("foo");
+    QVERIFY(author.save());
+
+    QDjangoQuerySet<Author> qs;
+    QCOMPARE(qs.size(), 1);
+
+    QDjango::removeQueryObserver(&recorder);
+    QVERIFY(author.save());
+
+    // check INSERT
+    QDjangoQueryEvent event = recorder.last(QLatin1String("INSERT"));
+    QCOMPARE(event.success, true);
+    QCOMPARE(event.connectionName, QDjango::database().connectionName());
+    QCOMPARE(event.boundValues, QVariantList() << QString("foo"));
+    QCOMPARE(event.rowsReturned, -1);
+    QCOMPARE(event.rowsAffected, 1);
+    QVERIFY(event.executionTime > 0);
+    QCOMPARE(event.fetchTime, qint64(0));
+
+    // check SELECT
+    event = recorder.last(QLatin1String("SELECT"));
+    QCOMPARE(event.success, true);
+    QCOMPARE(event.boundValues, QVariantList());
+    QCOMPARE(event.rowsReturned, 1);
+    QVERIFY(event.prepareTime > 0);
+    QVERIFY(event.executionTime > 0);
+    QVERIFY(event.fetchTime > 0);
+
+    // no statements are reported once the observer is removed
+    QVERIFY(recorder.last(QLatin1String("UPDATE")).sql.isEmpty());
+
+    // errors are reported
+    recorder.events.clear();
+    QDjango::addQueryObserver(&recorder);
+    QDjangoQuery query(QDjango::database());
+    QVERIFY(!query.exec("SELECT foo"));
+    QDjango::removeQueryObserver(&recorder);
+    QCOMPARE(recorder.events.size(), 1);
+    QCOMPARE(recorder.events[0].sql, QLatin1String("SELECT foo"));
+    QCOMPARE(recorder.events[0].success, false);
+    QVERIFY(!recorder.events[0].error.isEmpty());
+}
+
+void tst_QDjango::slowQueryLog()
+{
+    const QString fileName = QDir::temp().filePath(QLatin1String("tst_qdjango-slow.log"));
+    QFile::remove(fileName);
+    QFile::remove(fileName + QLatin1String(".1"));
+
+    QDjangoSlowQueryLog slowLog(0, 2);
+    slowLog.setRedactionEnabled(true);
+    slowLog.setFileName(fileName, 1);
+    QDjango::addQueryObserver(&slowLog);
+
+    Author author;
+    author.setName("foo");
+    QVERIFY(author.save());
+
+    QDjangoQuerySet<Author> qs;
+    QCOMPARE(qs.filter(QDjangoWhere("name", QDjangoWhere::Equals, "foo")).size(), 1);
+
+    QDjango::removeQueryObserver(&slowLog);
+
+    // only the last entries are kept
+    const QList<QDjangoSlowQueryLog::Entry> entries = slowLog.entries();
+    QCOMPARE(entries.size(), 2);
+
+    const QDjangoSlowQueryLog::Entry entry = entries.last();
+    QVERIFY(entry.sql.startsWith(QLatin1String("SELECT")));
+    QCOMPARE(entry.boundValues, QVariantList() << QString("?"));
+    QVERIFY(entry.duration > 0);
+
+    const QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
+    if (databaseType == QDjangoDatabase::SQLite ||
+        databaseType == QDjangoDatabase::PostgreSQL ||
+        databaseType == QDjangoDatabase::MySqlServer)
+        QVERIFY(!entry.plan.isEmpty());
+
+    // the log file was rotated after each entry
+    QVERIFY(QFile::exists(fileName));
+    QVERIFY(QFile::exists(fileName + QLatin1String(".1")));
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray contents = file.readAll();
+    QVERIFY(contents.contains(entry.sql.toUtf8()));
+    QVERIFY(!contents.contains("foo"));
+    file.close();
+
+    QFile::remove(fileName);
+    for (int i = 1; i <= 5; ++i)
+        QFile::remove(fileName + QLatin1Char('.') + QString::number(i));
+
+    slowLog.clear();
+    QCOMPARE(slowLog.entries().size(), 0);
+}
+
 QTEST_MAIN(tst_QDjango)
 #include "tst_qdjango.moc"
@@ -142,6 +142,7 @@ private slots:
     void fieldNames();
     void orderLimitSql_data();
     void orderLimitSql();
+    void resolveCached();
 };
 
 Item::Item(QObject *parent)
@@ -553,6 +554,43 @@ void tst_QDjangoCompiler::fieldNames_data()
         << "\"owner\""
            " INNER JOIN \"item\" T0 ON T0.\"id\" = \"owner\".\"item1_id\"";
 
+    QTest::newRow("filter foreign pk") << QByteArray("Owner") << false
+        << (QStringList()
+            << "\"owner\".\"id\""
+            << "\"owner\".\"name\""
+            << "\"owner\".\"item1_id\""
+            << "\"owner\".\"item2_id\"")
+
+        // filtering
+        << (QDjangoWhere("item1__pk", QDjangoWhere::Equals, 1)
+           && QDjangoWhere("item2__id", QDjangoWhere::IsNull, true))
+        << "\"owner\".\"item1_id\" = ? AND \"owner\".\"item2_id\" IS NULL"
+        << (QVariantList() << 1)
+
+        // ordering
+        << QStringList("-item1__pk")
+        << QString(" ORDER BY \"owner\".\"item1_id\" DESC")
+
+        << QString("\"owner\"");
+
+    QTest::newRow("filter foreign pk two levels") << QByteArray("Top") << false
+        << (QStringList()
+            << "\"top\".\"id\""
+            << "\"top\".\"name\""
+            << "\"top\".\"owner_id\"")
+
+        // filtering
+        << QDjangoWhere("owner__item1__pk", QDjangoWhere::Equals, 1)
+        << "T0.\"item1_id\" = ?"
+        << (QVariantList() << 1)
+
+        // ordering
+        << QStringList("owner__pk")
+        << QString(" ORDER BY \"top\".\"owner_id\" ASC")
+
+        << "\"top\""
+           " INNER JOIN \"owner\" T0 ON T0.\"id\" = \"top\".\"owner_id\"";
+
     QTest::newRow("filter reverse field") << QByteArray("Owner") << false
         << (QStringList()
             << "\"owner\".\"id\""
@@ -592,6 +630,47 @@ void tst_QDjangoCompiler::fieldNames_data()
         << "\"owner\""
            " INNER JOIN \"item\" T0 ON T0.\"id\" = \"owner\".\"item1_id\""
            " INNER JOIN \"item\" T1 ON T1.\"id\" = \"owner\".\"item2_id\"";
+
+    QTest::newRow("filter subquery") << QByteArray("Owner") << false
+        << (QStringList()
+            << "\"owner\".\"id\""
+            << "\"owner\".\"name\""
+            << "\"owner\".\"item1_id\""
+            << "\"owner\".\"item2_id\"")
+
+        // filtering
+        << (QDjangoWhere("name", QDjangoWhere::Equals, "bar")
+           && QDjangoWhere("item1_id", QDjangoWhere::IsIn, QDjangoQuerySet<Item>().filter(
+                QDjangoWhere("name", QDjangoWhere::Equals, "foo"))))
+        << "\"owner\".\"name\" = ? AND \"owner\".\"item1_id\" IN (SELECT \"item\".\"id\" FROM \"item\" WHERE \"item\".\"name\" = ?)"
+        << (QVariantList() << "bar" << "foo")
+
+        // ordering
+        << QStringList()
+        << ""
+
+        << "\"owner\"";
+
+    QTest::newRow("filter subquery with join") << QByteArray("Top") << false
+        << (QStringList()
+            << "\"top\".\"id\""
+            << "\"top\".\"name\""
+            << "\"top\".\"owner_id\"")
+
+        // filtering
+        << (QDjangoWhere("owner__name", QDjangoWhere::Equals, "bar")
+           && !QDjangoWhere("owner_id", QDjangoWhere::IsIn, QDjangoQuerySet<Owner>().filter(
+                QDjangoWhere("item1__name", QDjangoWhere::Equals, "foo"))))
+        << "T0.\"name\" = ? AND \"top\".\"owner_id\" NOT IN (SELECT \"owner\".\"id\" FROM \"owner\""
+           " INNER JOIN \"item\" S0_T0 ON S0_T0.\"id\" = \"owner\".\"item1_id\" WHERE S0_T0.\"name\" = ?)"
+        << (QVariantList() << "bar" << "foo")
+
+        // ordering
+        << QStringList()
+        << ""
+
+        << "\"top\""
+           " INNER JOIN \"owner\" T0 ON T0.\"id\" = \"top\".\"owner_id\"";
 }
 
 void tst_QDjangoCompiler::fieldNames()
@@ -669,6 +748,30 @@ void tst_QDjangoCompiler::orderLimitSql()
     QCOMPARE(compiler.orderLimitSql(orderBy, lowMark, highMark), sql);
 }
 
+/** Test that resolved lookups are reused without leaking table aliases
+ *  between compilers.
+ */
+void tst_QDjangoCompiler::resolveCached()
+{
+    QSqlDatabase db = QDjango::database();
+
+    QDjangoCompiler first("Owner", db);
+    QCOMPARE(normalizeSql(db, first.orderLimitSql(QStringList() << "item1__name" << "-item2__name", 0, 0)),
+             QString(" ORDER BY T0.\"name\" ASC, T1.\"name\" DESC"));
+    QCOMPARE(normalizeSql(db, first.fromSql()),
+             QString("\"owner\""
+                     " INNER JOIN \"item\" T0 ON T0.\"id\" = \"owner\".\"item1_id\""
+                     " INNER JOIN \"item\" T1 ON T1.\"id\" = \"owner\".\"item2_id\""));
+
+    QDjangoCompiler second("Owner", db);
+    QCOMPARE(normalizeSql(db, second.orderLimitSql(QStringList() << "-item2__name" << "item1__name", 0, 0)),
+             QString(" ORDER BY T0.\"name\" DESC, T1.\"name\" ASC"));
+    QCOMPARE(normalizeSql(db, second.fromSql()),
+             QString("\"owner\""
+                     " INNER JOIN \"item\" T1 ON T1.\"id\" = \"owner\".\"item1_id\""
+                     " INNER JOIN \"item\" T0 ON T0.\"id\" = \"owner\".\"item2_id\""));
+}
+
 Q_DECLARE_METATYPE(QDjangoWhere)
 QTEST_MAIN(tst_QDjangoCompiler)
 #include "tst_qdjangocompiler.moc"
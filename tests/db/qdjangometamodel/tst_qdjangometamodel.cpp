@@ -15,6 +15,10 @@
  * Lesser General Public License for more details.
  */
 
+#include <QSqlDriver>
+
+#include <vector>
+
 #include "QDjango.h"
 #include "QDjango_p.h"
 #include "QDjangoModel.h"
@@ -59,6 +63,12 @@ void cleanup()
     QCOMPARE(metaModel.dropTable(), true);
 }
 
+tst_Descriptor::tst_Descriptor(QObject *parent)
+    : QDjangoModel(parent)
+    , m_rank(0)
+{
+}
+
 tst_FkConstraint::tst_FkConstraint(QObject *parent)
     : QDjangoModel(parent)
 {
@@ -417,6 +427,223 @@ void tst_QDjangoMetaModel::testOptions()
     cleanup<tst_Options>();
 }
 
+/** Test composite, descending, covering and partial indexes.
+ */
+void tst_QDjangoMetaModel::testIndexes()
+{
+    QStringList sql;
+    QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
+    if (databaseType == QDjangoDatabase::PostgreSQL) {
+        sql << QLatin1String(
+            "CREATE TABLE \"tst_indexes\" ("
+                "\"id\" serial PRIMARY KEY, "
+                "\"name\" varchar(50) NOT NULL, "
+                "\"priority\" integer NOT NULL, "
+                "\"score\" integer NOT NULL"
+            ")");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_9d937205\" ON \"tst_indexes\" (lower(\"name\"))");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_3cc85d06\" ON \"tst_indexes\" (\"name\", \"priority\" DESC)");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_9907f44e\" ON \"tst_indexes\" (\"priority\") INCLUDE (\"score\") WHERE priority > 0");
+    } else if (databaseType == QDjangoDatabase::MySqlServer) {
+        sql << QLatin1String(
+            "CREATE TABLE `tst_indexes` ("
+                "`id` integer NOT NULL PRIMARY KEY AUTO_INCREMENT, "
+                "`name` varchar(50) NOT NULL, "
+                "`priority` integer NOT NULL, "
+                "`score` integer NOT NULL"
+            ")");
+        sql << QLatin1String("CREATE INDEX `tst_indexes_3cc85d06` ON `tst_indexes` (`name`, `priority` DESC)");
+        sql << QLatin1String("CREATE INDEX `tst_indexes_9907f44e` ON `tst_indexes` (`priority`, `score`)");
+    } else if (databaseType == QDjangoDatabase::MSSqlServer) {
+        sql << QLatin1String(
+            "CREATE TABLE \"tst_indexes\" ("
+                "\"id\" int NOT NULL PRIMARY KEY IDENTITY(1,1), "
+                "\"name\" nvarchar(50) NOT NULL, "
+                "\"priority\" int NOT NULL, "
+                "\"score\" int NOT NULL"
+            ")");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_3cc85d06\" ON \"tst_indexes\" (\"name\", \"priority\" DESC)");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_9907f44e\" ON \"tst_indexes\" (\"priority\") INCLUDE (\"score\") WHERE priority > 0");
+    } else {
+        sql << QLatin1String(
+            "CREATE TABLE \"tst_indexes\" ("
+                "\"id\" integer NOT NULL PRIMARY KEY AUTOINCREMENT, "
+                "\"name\" varchar(50) NOT NULL, "
+                "\"priority\" integer NOT NULL, "
+                "\"score\" integer NOT NULL"
+            ")");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_3cc85d06\" ON \"tst_indexes\" (\"name\", \"priority\" DESC)");
+        sql << QLatin1String("CREATE INDEX \"tst_indexes_9907f44e\" ON \"tst_indexes\" (\"priority\", \"score\") WHERE priority > 0");
+    }
+
+    init<tst_Indexes>(sql);
+
+    tst_Indexes model;
+    model.setName("foo");
+    model.setPriority(2);
+    model.setScore(3);
+    QCOMPARE(model.save(), true);
+
+    cleanup<tst_Indexes>();
+}
+
+/** Test the cached escaped table and column names
+ */
+void tst_QDjangoMetaModel::testEscapedIdentifiers()
+{
+    QSqlDatabase db = QDjango::database();
+    QSqlDriver *driver = db.driver();
+    const QDjangoMetaModel metaModel = QDjango::registerModel<tst_Options>();
+
+    QCOMPARE(metaModel.escapedTable(db), driver->escapeIdentifier(QLatin1String("some_table"), QSqlDriver::TableName));
+    QCOMPARE(metaModel.escapedColumn("pk", db), driver->escapeIdentifier(QLatin1String("id"), QSqlDriver::FieldName));
+    QCOMPARE(metaModel.escapedColumn("bField", db), driver->escapeIdentifier(QLatin1String("b_field"), QSqlDriver::FieldName));
+
+    const QStringList columns = metaModel.escapedColumns(db);
+    QCOMPARE(columns.size(), metaModel.localFields().size());
+    for (int i = 0; i < columns.size(); ++i)
+        QCOMPARE(columns[i], driver->escapeIdentifier(metaModel.localFields()[i].column(), QSqlDriver::FieldName));
+
+    // copies of the meta model share the cache
+    const QDjangoMetaModel other = QDjango::metaModel("tst_Options");
+    QCOMPARE(other.escapedColumns(db), columns);
+
+    // entries are filled once and never replaced
+    const QDjangoMetaModelIdentifiers &escaped = metaModel.escapedIdentifiers(db);
+    QCOMPARE(escaped.table, metaModel.escapedTable(db));
+    QCOMPARE(escaped.columns, columns);
+    QVERIFY(&other.escapedIdentifiers(db) == &escaped);
+}
+
+void tst_QDjangoMetaModel::testLocalFieldIndex()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<tst_Options>();
+    const QList<QDjangoMetaField> fields = metaModel.localFields();
+
+    for (int i = 0; i < fields.size(); ++i)
+        QCOMPARE(metaModel.localFieldIndex(fields[i].name().toLatin1()), i);
+    QCOMPARE(metaModel.localFieldIndex("pk"), metaModel.localFieldIndex("id"));
+    QCOMPARE(metaModel.localFieldIndex("bField"), 2);
+    QCOMPARE(metaModel.localFieldIndex("ignoredField"), -1);
+    QCOMPARE(metaModel.localFieldIndex("doesNotExist"), -1);
+
+    QCOMPARE(metaModel.localField("bField").column(), QLatin1String("b_field"));
+    QVERIFY(!metaModel.localField("doesNotExist").isValid());
+}
+
+void tst_QDjangoMetaModel::testLoad()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<tst_Options>();
+
+    // id, aField, bField, blankField, indexField, nullField, uniqueField
+    const QVariantList properties = QVariantList() << 7 << 1 << 2 << 3 << 4 << 5 << 6;
+    tst_Options options;
+    int pos = 0;
+    metaModel.load(&options, properties, pos);
+    QCOMPARE(pos, properties.size());
+    QCOMPARE(options.pk(), QVariant(7));
+    QCOMPARE(options.aField(), 1);
+    QCOMPARE(options.bField(), 2);
+    QCOMPARE(options.blankField(), 3);
+    QCOMPARE(options.indexField(), 4);
+    QCOMPARE(options.nullField(), 5);
+    QCOMPARE(options.uniqueField(), 6);
+}
+
+void tst_QDjangoMetaModel::testDescriptor()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<tst_Descriptor>();
+    QCOMPARE(metaModel.localFields().size(), 3);
+    QCOMPARE(metaModel.localFields()[0].name(), QLatin1String("id"));
+    QCOMPARE(metaModel.localFields()[1].name(), QLatin1String("name"));
+    QCOMPARE(metaModel.localFields()[1].maxLength(), 100);
+    QCOMPARE(metaModel.localFields()[1].isUnique(), true);
+    QCOMPARE(metaModel.localFields()[2].name(), QLatin1String("rank"));
+
+    // load through the descriptor
+    const QVariantList properties = QVariantList() << 3 << QLatin1String("foo") << 5;
+    tst_Descriptor v1;
+    int pos = 0;
+    metaModel.load(&v1, properties, pos);
+    QCOMPARE(pos, properties.size());
+    QCOMPARE(v1.pk(), QVariant(3));
+    QCOMPARE(v1.name(), QLatin1String("foo"));
+    QCOMPARE(v1.rank(), 5);
+
+    // save and fetch back
+    QCOMPARE(metaModel.createTable(), true);
+    tst_Descriptor v2;
+    v2.setName(QLatin1String("bar"));
+    v2.setRank(7);
+    QCOMPARE(v2.save(), true);
+    QVERIFY(!v2.pk().isNull());
+
+    tst_Descriptor v3;
+    QVERIFY(QDjangoQuerySet<tst_Descriptor>().get(Q(QLatin1String("pk"), Q::Equals, v2.pk()), &v3) != 0);
+    QCOMPARE(v3.pk(), v2.pk());
+    QCOMPARE(v3.name(), QLatin1String("bar"));
+    QCOMPARE(v3.rank(), 7);
+
+    QCOMPARE(metaModel.fieldValue(&v3, "rank"), QVariant(7));
+    metaModel.setFieldValue(&v3, "rank", 8);
+    QCOMPARE(v3.rank(), 8);
+    QCOMPARE(v3.save(), true);
+    QCOMPARE(QDjangoQuerySet<tst_Descriptor>().filter(Q(QLatin1String("rank"), Q::Equals, 8)).count(), 1);
+
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
+void tst_QDjangoMetaModel::testPlain()
+{
+    const QDjangoMetaModel metaModel = QDjango::registerModel<tst_Plain>();
+    QCOMPARE(metaModel.isValid(), true);
+    QCOMPARE(metaModel.className(), QLatin1String("tst_Plain"));
+    QCOMPARE(metaModel.table(), QLatin1String("plain_table"));
+    QCOMPARE(metaModel.primaryKey(), QByteArray("id"));
+    QCOMPARE(metaModel.localFields().size(), 3);
+    QCOMPARE(metaModel.localFields()[1].maxLength(), 100);
+    QCOMPARE(metaModel.createTable(), true);
+
+    tst_Plain foo;
+    foo.name = QLatin1String("foo");
+    foo.score = 1.5;
+    tst_Plain bar;
+    bar.name = QLatin1String("bar");
+    bar.score = 2.5;
+
+    QDjangoQuerySet<tst_Plain> qs;
+    QVERIFY(qs.bulkInsert(QList<tst_Plain*>() << &foo << &bar));
+    QCOMPARE(qs.count(), 2);
+
+    // load into contiguous storage
+    std::vector<tst_Plain> objects;
+    QVERIFY(qs.orderBy(QStringList() << QLatin1String("name")).load(objects));
+    QCOMPARE(int(objects.size()), 2);
+    QVERIFY(objects[0].id > 0);
+    QCOMPARE(objects[0].name, QLatin1String("bar"));
+    QCOMPARE(objects[0].score, 2.5);
+    QVERIFY(objects[1].id > 0);
+    QCOMPARE(objects[1].name, QLatin1String("foo"));
+    QCOMPARE(objects[1].score, 1.5);
+
+    // load a single object
+    tst_Plain other;
+    QVERIFY(qs.get(Q(QLatin1String("name"), Q::Equals, QLatin1String("foo")), &other) != 0);
+    QCOMPARE(other.id, objects[1].id);
+    QCOMPARE(other.score, 1.5);
+
+    // update and remove
+    QVariantMap fields;
+    fields.insert(QLatin1String("score"), 3.5);
+    QCOMPARE(qs.filter(Q(QLatin1String("name"), Q::Equals, QLatin1String("foo"))).update(fields), 1);
+    QVERIFY(qs.bulkRemove(QList<tst_Plain*>() << &objects[0]));
+    QCOMPARE(qs.count(), 1);
+    QVERIFY(qs.get(Q(QLatin1String("pk"), Q::Equals, objects[1].id), &other) != 0);
+    QCOMPARE(other.score, 3.5);
+
+    QCOMPARE(metaModel.dropTable(), true);
+}
+
 /** Test foreign key constraint sql generation
  */
 void tst_QDjangoMetaModel::testConstraints()
@@ -18,6 +18,7 @@
 #include <QDate>
 
 #include "QDjangoModel.h"
+#include "QDjangoModelDescriptor.h"
 
 #include "auth-models.h"
 
@@ -37,6 +38,12 @@ private slots:
     void testString();
     void testTime();
     void testOptions();
+    void testIndexes();
+    void testEscapedIdentifiers();
+    void testLocalFieldIndex();
+    void testLoad();
+    void testDescriptor();
+    void testPlain();
     void testConstraints();
     void testIsValid();
 };
@@ -210,6 +217,94 @@ private:
     int m_uniqueField;
 };
 
+class tst_Indexes : public QDjangoModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString name READ name WRITE setName)
+    Q_PROPERTY(int priority READ priority WRITE setPriority)
+    Q_PROPERTY(int score READ score WRITE setScore)
+
+    Q_CLASSINFO("__meta__", "db_table=tst_indexes index_together=\"name,-priority;priority+score?priority > 0\"")
+    Q_CLASSINFO("name", "max_length=50 case_insensitive=true")
+
+public:
+    QString name() const { return m_name; }
+    void setName(const QString &name) { m_name = name; }
+
+    int priority() const { return m_priority; }
+    void setPriority(int priority) { m_priority = priority; }
+
+    int score() const { return m_score; }
+    void setScore(int score) { m_score = score; }
+
+private:
+    QString m_name;
+    int m_priority;
+    int m_score;
+};
+
+class tst_Descriptor : public QDjangoModel
+{
+    Q_OBJECT
+
+public:
+    tst_Descriptor(QObject *parent = 0);
+
+    QString name() const { return m_name; }
+    void setName(const QString &name) { m_name = name; }
+
+    int rank() const { return m_rank; }
+    void setRank(int rank) { m_rank = rank; }
+
+private:
+    QString m_name;
+    int m_rank;
+};
+
+template <>
+class QDjangoModelDescriptor<tst_Descriptor>
+{
+public:
+    enum { IsDefined = 1 };
+
+    template <class Visitor>
+    static void visit(Visitor &visitor)
+    {
+        visitor(qdjangoField("name", &tst_Descriptor::name, &tst_Descriptor::setName, "max_length=100 unique=true"));
+        visitor(qdjangoField("rank", &tst_Descriptor::rank, &tst_Descriptor::setRank));
+    }
+};
+
+struct tst_Plain
+{
+    int id;
+    QString name;
+    double score;
+};
+
+template <>
+class QDjangoModelTraits<tst_Plain> : public QDjangoPlainModelTraits
+{
+public:
+    static const char *className() { return "tst_Plain"; }
+    static const char *options() { return "db_table=plain_table"; }
+};
+
+template <>
+class QDjangoModelDescriptor<tst_Plain>
+{
+public:
+    enum { IsDefined = 1 };
+
+    template <class Visitor>
+    static void visit(Visitor &visitor)
+    {
+        visitor(qdjangoField("id", &tst_Plain::id, "primary_key=true auto_increment=true"));
+        visitor(qdjangoField("name", &tst_Plain::name, "max_length=100"));
+        visitor(qdjangoField("score", &tst_Plain::score));
+    }
+};
+
 class tst_FkConstraint : public QDjangoModel
 {
     Q_OBJECT
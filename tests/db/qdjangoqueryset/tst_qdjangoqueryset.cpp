@@ -52,11 +52,14 @@ class tst_QDjangoQuerySetPrivate : public QObject
 
 private slots:
     void initTestCase();
+    void bulkDeleteQuery();
+    void bulkInsertQuery();
     void countQuery();
     void deleteQuery();
     void insertQuery();
     void selectQuery();
     void updateQuery();
+    void valuesQuery();
     void cleanupTestCase();
 
 private:
@@ -71,6 +74,38 @@ void tst_QDjangoQuerySetPrivate::initTestCase()
     QCOMPARE(metaModel.createTable(), true);
 }
 
+void tst_QDjangoQuerySetPrivate::bulkDeleteQuery()
+{
+    QDjangoQuerySetPrivate qs("Object");
+    QDjangoQuery query = qs.bulkDeleteQuery(QVariantList() << 1 << 2);
+
+    QCOMPARE(normalizeSql(QDjango::database(), query.lastQuery()), QLatin1String("DELETE FROM \"foo_table\" WHERE \"id\" = ?"));
+    QCOMPARE(query.boundValues().size(), 1);
+    QCOMPARE(query.boundValue(0), QVariant(QVariantList() << 1 << 2));
+}
+
+void tst_QDjangoQuerySetPrivate::bulkInsertQuery()
+{
+    QVariantMap row1;
+    row1.insert("foo", "abc");
+    row1.insert("bar", 1);
+    QVariantMap row2;
+    row2.insert("foo", "def");
+    row2.insert("bar", 2);
+
+    QDjangoQuerySetPrivate qs("Object");
+    QDjangoQuery query = qs.bulkInsertQuery(QList<QVariantMap>() << row1 << row2);
+
+    QCOMPARE(normalizeSql(QDjango::database(), query.lastQuery()), QLatin1String("INSERT INTO \"foo_table\" (\"bar_column\", \"foo\") VALUES(?, ?)"));
+    QCOMPARE(query.boundValues().size(), 2);
+    QCOMPARE(query.boundValue(0), QVariant(QVariantList() << 1 << 2));
+    QCOMPARE(query.boundValue(1), QVariant(QVariantList() << "abc" << "def"));
+    QVERIFY(query.execBatch());
+
+    QDjangoQuerySetPrivate qs2("Object");
+    QCOMPARE(qs2.sqlBulkDelete(QVariantList() << 1 << 2), true);
+}
+
 void tst_QDjangoQuerySetPrivate::countQuery()
 {
     QDjangoQuerySetPrivate qs("Object");
@@ -160,6 +195,27 @@ void tst_QDjangoQuerySetPrivate::updateQuery()
     }
 }
 
+void tst_QDjangoQuerySetPrivate::valuesQuery()
+{
+    {
+        QDjangoQuerySetPrivate qs("Object");
+        QDjangoQuery query = qs.valuesQuery(QStringList());
+
+        QCOMPARE(normalizeSql(QDjango::database(), query.lastQuery()), QLatin1String("SELECT \"foo_table\".\"id\", \"foo_table\".\"foo\", \"foo_table\".\"bar_column\" FROM \"foo_table\""));
+        QCOMPARE(query.boundValues().size(), 0);
+    }
+
+    {
+        QDjangoQuerySetPrivate qs("Object");
+        qs.addFilter(QDjangoWhere("foo", QDjangoWhere::Equals, "abc"));
+        QDjangoQuery query = qs.valuesQuery(QStringList() << "bar");
+
+        QCOMPARE(normalizeSql(QDjango::database(), query.lastQuery()), QLatin1String("SELECT \"foo_table\".\"bar_column\" FROM \"foo_table\" WHERE \"foo_table\".\"foo\" = ?"));
+        QCOMPARE(query.boundValues().size(), 1);
+        QCOMPARE(query.boundValue(0), QVariant("abc"));
+    }
+}
+
 void tst_QDjangoQuerySetPrivate::cleanupTestCase()
 {
     metaModel.dropTable();
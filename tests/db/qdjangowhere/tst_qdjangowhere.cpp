@@ -37,6 +37,7 @@ private slots:
     void lessThan();
     void lessOrEquals();
     void isIn();
+    void isInLarge();
     void isNull();
     void startsWith();
     void iStartsWith();
@@ -47,6 +48,7 @@ private slots:
     void andWhere();
     void orWhere();
     void complexWhere();
+    void simplified();
     void toString();
 };
 
@@ -94,10 +96,10 @@ void tst_QDjangoWhere::iEqualsWhere()
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
      if (databaseType == QDjangoDatabase::PostgreSQL) {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IEquals, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) LIKE UPPER(?)"), QVariantList() << "abc");
+        CHECKWHERE(testQuery, QLatin1String("lower(name::text) = lower(?)"), QVariantList() << "abc");
 
         testQuery = !QDjangoWhere("name", QDjangoWhere::IEquals, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) NOT LIKE UPPER(?)"), QVariantList() << "abc");
+        CHECKWHERE(testQuery, QLatin1String("lower(name::text) != lower(?)"), QVariantList() << "abc");
     } else {
          QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IEquals, "abc");
          CHECKWHERE(testQuery, QLatin1String("name LIKE ?"), QVariantList() << "abc");
@@ -130,10 +132,10 @@ void tst_QDjangoWhere::iNotEqualsWhere()
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
     if (databaseType == QDjangoDatabase::PostgreSQL) {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::INotEquals, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) NOT LIKE UPPER(?)"), QVariantList() << "abc");
+        CHECKWHERE(testQuery, QLatin1String("lower(name::text) != lower(?)"), QVariantList() << "abc");
 
         testQuery = !QDjangoWhere("name", QDjangoWhere::INotEquals, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) LIKE UPPER(?)"), QVariantList() << "abc");
+        CHECKWHERE(testQuery, QLatin1String("lower(name::text) = lower(?)"), QVariantList() << "abc");
     } else {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::INotEquals, "abc");
         CHECKWHERE(testQuery, QLatin1String("name NOT LIKE ?"), QVariantList() << "abc");
@@ -206,6 +208,65 @@ void tst_QDjangoWhere::isIn()
     CHECKWHERE(testQuery, QLatin1String("id NOT IN (?, ?)"), QVariantList() << 1 << 2);
 }
 
+/** Test "in" comparison with a large list of values.
+ */
+void tst_QDjangoWhere::isInLarge()
+{
+    QVariantList values;
+    QStringList arrayBits;
+    QStringList jsonBits;
+    QStringList holders;
+    for (int i = 0; i < 1000; ++i) {
+        values << i;
+        arrayBits << QString::fromLatin1("\"%1\"").arg(i);
+        jsonBits << QString::number(i);
+        holders << QLatin1String("?");
+    }
+    const QString chunk = holders.mid(0, 500).join(QLatin1String(", "));
+
+    QSqlDatabase db = QDjango::database();
+    QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(db);
+    if (databaseType == QDjangoDatabase::PostgreSQL) {
+        const QString array = QLatin1Char('{') + arrayBits.join(QLatin1String(",")) + QLatin1Char('}');
+
+        QDjangoWhere testQuery = QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QLatin1String("id = ANY(?)"), QVariantList() << array);
+
+        testQuery = !QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QLatin1String("NOT (id = ANY(?))"), QVariantList() << array);
+    } else if (databaseType == QDjangoDatabase::SQLite) {
+        const bool hasJson = QDjangoDatabase::hasJsonSupport(db);
+        if (hasJson) {
+            const QString json = QLatin1Char('[') + jsonBits.join(QLatin1String(",")) + QLatin1Char(']');
+
+            QDjangoWhere testQuery = QDjangoWhere("id", QDjangoWhere::IsIn, values);
+            CHECKWHERE(testQuery, QLatin1String("id IN (SELECT value FROM json_each(?))"), QVariantList() << json);
+
+            testQuery = !QDjangoWhere("id", QDjangoWhere::IsIn, values);
+            CHECKWHERE(testQuery, QLatin1String("id NOT IN (SELECT value FROM json_each(?))"), QVariantList() << json);
+        }
+
+        // without JSON support, the values are inlined so as not to exceed
+        // the 999 bound values older SQLite builds accept
+        QDjangoDatabase::setJsonSupport(false);
+        const QString literals = jsonBits.join(QLatin1String(", "));
+
+        QDjangoWhere testQuery = QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QString::fromLatin1("id IN (%1)").arg(literals), QVariantList());
+
+        testQuery = !QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QString::fromLatin1("id NOT IN (%1)").arg(literals), QVariantList());
+
+        QDjangoDatabase::setJsonSupport(hasJson);
+    } else {
+        QDjangoWhere testQuery = QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QString::fromLatin1("(id IN (%1) OR id IN (%1))").arg(chunk), values);
+
+        testQuery = !QDjangoWhere("id", QDjangoWhere::IsIn, values);
+        CHECKWHERE(testQuery, QString::fromLatin1("(id NOT IN (%1) AND id NOT IN (%1))").arg(chunk), values);
+    }
+}
+
 /** Test "isnull" comparison.
  */
 void tst_QDjangoWhere::isNull()
@@ -249,10 +310,10 @@ void tst_QDjangoWhere::iStartsWith()
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
     if (databaseType == QDjangoDatabase::PostgreSQL) {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IStartsWith, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) LIKE UPPER(?)"), QVariantList() << "abc%");
+        CHECKWHERE(testQuery, QLatin1String("name::text ILIKE ?"), QVariantList() << "abc%");
 
         testQuery = !QDjangoWhere("name", QDjangoWhere::IStartsWith, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) NOT LIKE UPPER(?)"), QVariantList() << "abc%");
+        CHECKWHERE(testQuery, QLatin1String("name::text NOT ILIKE ?"), QVariantList() << "abc%");
     } else {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IStartsWith, "abc");
         CHECKWHERE(testQuery, QLatin1String("name LIKE ?"), QVariantList() << "abc%");
@@ -290,10 +351,10 @@ void tst_QDjangoWhere::iEndsWith()
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
     if (databaseType == QDjangoDatabase::PostgreSQL) {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IEndsWith, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) LIKE UPPER(?)"), QVariantList() << "%abc");
+        CHECKWHERE(testQuery, QLatin1String("name::text ILIKE ?"), QVariantList() << "%abc");
 
         testQuery = !QDjangoWhere("name", QDjangoWhere::IEndsWith, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) NOT LIKE UPPER(?)"), QVariantList() << "%abc");
+        CHECKWHERE(testQuery, QLatin1String("name::text NOT ILIKE ?"), QVariantList() << "%abc");
     } else {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IEndsWith, "abc");
         CHECKWHERE(testQuery, QLatin1String("name LIKE ?"), QVariantList() << "%abc");
@@ -333,10 +394,10 @@ void tst_QDjangoWhere::iContains()
     QDjangoDatabase::DatabaseType databaseType = QDjangoDatabase::databaseType(QDjango::database());
     if (databaseType == QDjangoDatabase::PostgreSQL) {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IContains, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) LIKE UPPER(?)"), QVariantList() << "%abc%");
+        CHECKWHERE(testQuery, QLatin1String("name::text ILIKE ?"), QVariantList() << "%abc%");
 
         testQuery = !QDjangoWhere("name", QDjangoWhere::IContains, "abc");
-        CHECKWHERE(testQuery, QLatin1String("UPPER(name::text) NOT LIKE UPPER(?)"), QVariantList() << "%abc%");
+        CHECKWHERE(testQuery, QLatin1String("name::text NOT ILIKE ?"), QVariantList() << "%abc%");
     } else {
         QDjangoWhere testQuery = QDjangoWhere("name", QDjangoWhere::IContains, "abc");
         CHECKWHERE(testQuery, QLatin1String("name LIKE ?"), QVariantList() << "%abc%");
@@ -435,6 +496,74 @@ void tst_QDjangoWhere::complexWhere()
     CHECKWHERE(testQuery, QLatin1String("id = ? OR username = ? OR password = ?"), QVariantList() << 1 << "foouser" << "foopass");
 }
 
+/** Test simplification of where clauses.
+ */
+void tst_QDjangoWhere::simplified()
+{
+    QDjangoWhere testQuery;
+
+    const QDjangoWhere queryId("id", QDjangoWhere::Equals, 1);
+    const QDjangoWhere queryUsername("username", QDjangoWhere::Equals, "foouser");
+    const QDjangoWhere queryPassword("password", QDjangoWhere::Equals, "foopass");
+
+    // single test is left alone
+    testQuery = queryId.simplified();
+    CHECKWHERE(testQuery, QLatin1String("id = ?"), QVariantList() << 1);
+
+    // nested clauses are flattened
+    testQuery = queryId && (queryUsername && queryPassword);
+    CHECKWHERE(testQuery, QLatin1String("id = ? AND (username = ? AND password = ?)"), QVariantList() << 1 << "foouser" << "foopass");
+    CHECKWHERE(testQuery.simplified(), QLatin1String("id = ? AND username = ? AND password = ?"), QVariantList() << 1 << "foouser" << "foopass");
+
+    // negated clauses are not flattened
+    testQuery = (queryId && !(queryUsername && queryPassword)).simplified();
+    CHECKWHERE(testQuery, QLatin1String("id = ? AND (NOT (username = ? AND password = ?))"), QVariantList() << 1 << "foouser" << "foopass");
+
+    // duplicates are removed
+    testQuery = ((queryId && queryUsername) || (queryId && queryUsername)).simplified();
+    CHECKWHERE(testQuery, QLatin1String("id = ? AND username = ?"), QVariantList() << 1 << "foouser");
+
+    testQuery = (queryId && queryUsername && queryId).simplified();
+    CHECKWHERE(testQuery, QLatin1String("id = ? AND username = ?"), QVariantList() << 1 << "foouser");
+
+    // equality tests on the same column are merged
+    testQuery = (queryId || queryUsername || QDjangoWhere("id", QDjangoWhere::Equals, 2)).simplified();
+    CHECKWHERE(testQuery, QLatin1String("id IN (?, ?) OR username = ?"), QVariantList() << 1 << 2 << "foouser");
+
+    testQuery = (queryId || QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList() << 1 << 3)).simplified();
+    CHECKWHERE(testQuery, QLatin1String("id IN (?, ?)"), QVariantList() << 1 << 3);
+
+    // empty lists never match
+    testQuery = QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList()).simplified();
+    QCOMPARE(testQuery.isNone(), true);
+
+    testQuery = (!QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList())).simplified();
+    QCOMPARE(testQuery.isAll(), true);
+
+    testQuery = (queryUsername && QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList())).simplified();
+    QCOMPARE(testQuery.isNone(), true);
+
+    testQuery = (queryUsername || QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList())).simplified();
+    CHECKWHERE(testQuery, QLatin1String("username = ?"), QVariantList() << "foouser");
+
+    // impossible constraints
+    testQuery = (queryId && queryUsername && QDjangoWhere("id", QDjangoWhere::Equals, 2)).simplified();
+    QCOMPARE(testQuery.isNone(), true);
+
+    testQuery = (queryId && QDjangoWhere("id", QDjangoWhere::IsIn, QVariantList() << 2 << 3)).simplified();
+    QCOMPARE(testQuery.isNone(), true);
+
+    testQuery = (!(queryId && QDjangoWhere("id", QDjangoWhere::Equals, 2))).simplified();
+    QCOMPARE(testQuery.isAll(), true);
+
+    testQuery = (queryPassword || (queryId && QDjangoWhere("id", QDjangoWhere::Equals, 2))).simplified();
+    CHECKWHERE(testQuery, QLatin1String("password = ?"), QVariantList() << "foopass");
+
+    // string comparisons depend on the collation
+    testQuery = (queryUsername && QDjangoWhere("username", QDjangoWhere::Equals, "FOOUSER")).simplified();
+    CHECKWHERE(testQuery, QLatin1String("username = ? AND username = ?"), QVariantList() << "foouser" << "FOOUSER");
+}
+
 void tst_QDjangoWhere::toString()
 {
     QDjangoWhere testQuery;